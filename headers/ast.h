@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <assert.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include "utils.h"
 
 #define U64 __uint64_t
@@ -26,53 +28,104 @@ typedef enum {
     NK_GEQ = set_bit(10),
 
     NK_E = set_bit(11),
-    NK_IF_THEN_ELSE = set_bit(12)
+    NK_IF_THEN_ELSE = set_bit(12),
+
+    // fused nodes, only created by the peephole pass
+    NK_FMA = set_bit(13),
+    NK_AFFINE_X = set_bit(14),
+    NK_AFFINE_Y = set_bit(15)
 } Node_kind;
 
+#define N_NODE_KINDS 16
+#define node_kind_index(nk) __builtin_ctz(nk)
+
 #define NK_UNOP (NK_SIN | NK_COS | NK_EXP)
 #define NK_BINOP (NK_ADD | NK_MULT | NK_MOD | NK_DIV | NK_GEQ)
 #define NK_TRIPLE (NK_E | NK_IF_THEN_ELSE)
+#define NK_TERNOP (NK_FMA) // numeric ops with 3 children, stored like a triple
+#define NK_AFFINE (NK_AFFINE_X | NK_AFFINE_Y)
 
 typedef struct s_Node Node;
 
 typedef struct{
-    size_t rhs;
-    size_t lhs;    
+    uint32_t lhs;
+    uint32_t rhs;
 } Binop;
 
 typedef struct{
-    size_t first;
-    size_t second; 
-    size_t third;  
+    uint32_t first;
+    uint32_t second; 
+    uint32_t third;  
 } Triple;
 
+typedef struct{
+    float scale;
+    float offset;
+} Affine;
+
 typedef union{
-    size_t unop;
+    uint32_t unop;
     Binop binop;
     Triple triple;
+    Affine affine;
     float number;
 } Node_as;
 
+/*
+    Nodes only hold what evaluation needs, an opcode and up to 3 child indices or a constant, which keeps them at 16 bytes.
+    Where each node was added is kept in a separate table, only in debug builds.
+*/
 struct s_Node {
-    Node_kind nk;
+    uint8_t op; // `node_kind_index` of the node kind, read it back with `node_kind`
     Node_as as;
+};
+
+#define node_kind(n) ((Node_kind)set_bit((n)->op))
+
+#ifdef DEBUG
+typedef struct {
     int line;
     char* file;
 
     float prob;
-};
+} Node_debug;
+#endif
 
 typedef struct{
     Node* array;
+    #ifdef DEBUG
+    Node_debug* debug; // parallel to `array`
+    #endif
     size_t used;
     size_t capacity;
 
     size_t ast_root;
     size_t size; // size of AST after initial generation
+
+    void* map; // set when `array` lives in a mapped file rather than on the heap
+    size_t map_size;
 } Ast;
 
 Ast ast = {0};
 
+#ifdef DEBUG
+#define node_line(index) (ast.debug[index].line)
+#define node_file(index) (ast.debug[index].file)
+#else
+#define node_line(index) 0
+#define node_file(index) NULL
+#endif
+
+/// @brief Print where the node at `index` was added, for error messages. Only debug builds know that, others print the node index
+/// @param index 
+void print_node_loc(size_t index){
+    #ifdef DEBUG
+    printf("[FILE %s] Node added at line %d ", node_file(index), node_line(index));
+    #else
+    printf("[NODE %ld] ", index);
+    #endif
+}
+
 void init_ast(size_t capacity){
 
     if(capacity <= 0){
@@ -86,14 +139,26 @@ void init_ast(size_t capacity){
             exit(-1);
         }
 
+        #ifdef DEBUG
+        ast.debug = (Node_debug*) malloc(sizeof(Node_debug) * capacity);
+        assert(ast.debug != NULL);
+        #endif
+
         ast.capacity = capacity;
         ast.used = 0;
+        ast.map = NULL;
     }
 }
 
 void free_ast(){
-    free(ast.array);
+    if(ast.map){
+        munmap(ast.map, ast.map_size);
+    } else {
+        free(ast.array);
+    }
+
     #ifdef DEBUG
+    free(ast.debug);
     printf("Freed ast memory\n");
     #endif
 }
@@ -113,12 +178,25 @@ void find_ast_root(){
 
 void free_grammar();
 
-/// @brief Move ast node array to a new mem location
+/// @brief Move ast node array to a new mem location. A mapped array is copied to the heap
 /// @param new_cap New array capacity
 void reallocate_ast(size_t new_cap){
     ast.capacity = new_cap;
 
-    Node* nn = (Node*)realloc(ast.array, sizeof(Node) * ast.capacity);
+    Node* nn;
+
+    if(ast.map){
+        nn = (Node*)malloc(sizeof(Node) * ast.capacity);
+
+        if(nn != NULL){
+            memcpy(nn, ast.array, sizeof(Node) * ast.used);
+            munmap(ast.map, ast.map_size);
+            ast.map = NULL;
+        }
+
+    } else {
+        nn = (Node*)realloc(ast.array, sizeof(Node) * ast.capacity);
+    }
     
     if(nn == NULL){
         printf("[ERROR] Memory reallocation of failed!\n");
@@ -128,14 +206,28 @@ void reallocate_ast(size_t new_cap){
     }
 
     ast.array = nn; // move array pointer
+
+    #ifdef DEBUG
+    ast.debug = (Node_debug*)realloc(ast.debug, sizeof(Node_debug) * ast.capacity);
+    assert(ast.debug != NULL);
+    #endif
 }
 
-size_t add_node_to_ast(Node node){
+size_t add_node_to_ast(Node node, int line, char* file){
 
     if(ast.used >= ast.capacity){
         reallocate_ast(2 * ast.capacity);
     }
 
+    assert(ast.used < UINT32_MAX); // children are referred to with 32-bit indices
+
+    #ifdef DEBUG
+    ast.debug[ast.used] = (Node_debug){.line = line, .file = file};
+    #else
+    (void)line;
+    (void)file;
+    #endif
+
     ast.array[ast.used++] = node;
     
     assert(ast.used != 0);
@@ -146,81 +238,93 @@ size_t add_node_to_ast(Node node){
 }
 
 size_t node_number_loc(float n, int line, char* file){
-    Node node;
-    node.nk = NK_NUMBER;
+    Node node = {0};
+    node.op = node_kind_index(NK_NUMBER);
 
     node.as.number = n;
-    node.file = file;
-    node.line = line;
-
-    return add_node_to_ast(node); 
+    return add_node_to_ast(node, line, file);
 }
 
 size_t node_x_loc(int line, char* file){
-    Node node;
-    node.nk = NK_X;
+    Node node = {0};
+    node.op = node_kind_index(NK_X);
 
-    node.file = file;
-    node.line = line;
 
-    return add_node_to_ast(node);
+    return add_node_to_ast(node, line, file);
 }
 
 size_t node_y_loc(int line, char* file){
-    Node node;
-    node.nk = NK_Y;
+    Node node = {0};
+    node.op = node_kind_index(NK_Y);
 
-    node.file = file;
-    node.line = line;
     
-    return add_node_to_ast(node);
+    return add_node_to_ast(node, line, file);
 }
 
 size_t node_unop_loc(Node_kind nk, size_t arg, int line, char* file){
     assert(nk & NK_UNOP);
 
-    Node node;
-    node.nk = nk;
+    Node node = {0};
+    node.op = node_kind_index(nk);
 
-    node.line = line;
-    node.file = file;
     node.as.unop = arg;
 
-    return add_node_to_ast(node);
+    return add_node_to_ast(node, line, file);
 }
 
 size_t node_binop_loc(Node_kind nk, size_t lhs, size_t rhs, int line, char* file){
     assert(nk & NK_BINOP);
 
-    Node node;
-    node.nk = nk;
+    Node node = {0};
+    node.op = node_kind_index(nk);
 
     node.as.binop.lhs = lhs;
     node.as.binop.rhs = rhs;
-    node.file = file;
-    node.line = line;
 
-    return add_node_to_ast(node);
+    return add_node_to_ast(node, line, file);
 }
 
 size_t node_triple_loc(Node_kind nk, size_t first, size_t second, size_t third, int line, char* file){
     assert(nk & NK_TRIPLE);
     
-    Node node;
-    node.nk = nk;
+    Node node = {0};
+    node.op = node_kind_index(nk);
 
     node.as.triple.first = first;
     node.as.triple.second = second;
     node.as.triple.third = third;
-    node.file = file;
-    node.line = line;
 
-    return add_node_to_ast(node);
+    return add_node_to_ast(node, line, file);
+}
+
+size_t node_fma_loc(size_t a, size_t b, size_t c, int line, char* file){
+    Node node = {0};
+    node.op = node_kind_index(NK_FMA);
+
+    node.as.triple.first = a;
+    node.as.triple.second = b;
+    node.as.triple.third = c;
+
+    return add_node_to_ast(node, line, file);
+}
+
+size_t node_affine_loc(Node_kind nk, float scale, float offset, int line, char* file){
+    assert(nk & NK_AFFINE);
+
+    Node node = {0};
+    node.op = node_kind_index(nk);
+
+    node.as.affine.scale = scale;
+    node.as.affine.offset = offset;
+
+    return add_node_to_ast(node, line, file);
 }
 
 #define node_unop(nk, arg) node_unop_loc(nk, arg, __LINE__, __FILE__)
 #define node_binop(nk, lhs, rhs) node_binop_loc(nk, lhs, rhs, __LINE__, __FILE__)
 #define node_triple(nk, first, second, third) node_triple_loc(nk, first, second, third, __LINE__, __FILE__)
+#define node_fma(a, b, c) node_fma_loc(a, b, c, __LINE__, __FILE__)
+#define node_affine(nk, scale, offset) node_affine_loc(nk, scale, offset, __LINE__, __FILE__)
 #define node_number(n) node_number_loc(n, __LINE__, __FILE__)
 #define node_x node_x_loc(__LINE__, __FILE__)
 #define node_y node_y_loc(__LINE__, __FILE__)
@@ -230,7 +334,7 @@ size_t node_triple_loc(Node_kind nk, size_t first, size_t second, size_t third,
 void print_ast(size_t node_index){
     Node* n = ast.array + node_index;
 
-    switch(n->nk){
+    switch(node_kind(n)){
         case NK_X: 
             printf("x"); break;
 
@@ -308,21 +412,35 @@ void print_ast(size_t node_index){
         case NK_IF_THEN_ELSE:
             printf("if (");
             print_ast(n->as.triple.first);
-            printf(") then { ");
+            printf(") ");
             print_ast(n->as.triple.second);
-            printf(" } else { ");
+            printf(" else ");
             print_ast(n->as.triple.third);
-            printf("}");
             break;
         
         case NK_NUMBER:
             printf("%f", n->as.number); break;
 
+        case NK_FMA:
+            printf("add(mult(");
+            print_ast(n->as.triple.first);
+            printf(", ");
+            print_ast(n->as.triple.second);
+            printf("), ");
+            print_ast(n->as.triple.third);
+            printf(")");
+            break;
+
+        case NK_AFFINE_X:
+        case NK_AFFINE_Y:
+            printf("add(mult(%s, %f), %f)", (node_kind(n) == NK_AFFINE_X) ? "x" : "y", n->as.affine.scale, n->as.affine.offset);
+            break;
+
         default:
     
-            printf("[FILE %s] Node added at line %d ", n->file, n->line);
+            print_node_loc(node_index);
             printf("should not be able to reach this in print ast!\n");
-            printf("\nkind %d\n", n->nk);
+            printf("\nkind %d\n", node_kind(n));
 
             exit(-1);
     }
@@ -370,10 +488,12 @@ void incorrect_ast(){
 
     5 added just to be extra extra safe
 */
+#define eval_headroom(size) (2 * ((size) + 5))
+
 void reallocate_ast_after_build(){
 
-    if((ast.capacity - ast.size) <  2 * (ast.size + 5)){
-       reallocate_ast(2 * (ast.size + 5));
+    if((ast.capacity - ast.size) <  eval_headroom(ast.size)){
+       reallocate_ast(eval_headroom(ast.size));
     }
 }
 
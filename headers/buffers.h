@@ -0,0 +1,98 @@
+#ifndef BUFFERS_H
+#define BUFFERS_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "utils.h"
+
+/*
+    Pool of float buffers for sample planes. Renders happen over and over with the same sizes, so buffers are kept once
+    released and handed out again, instead of going back to malloc for a few MB every time. Buffers are aligned to cache
+    lines so that rows written by different threads never share one.
+*/
+
+#define CACHE_LINE 64
+#define MAX_BUFFERS 32
+
+typedef struct {
+    float* data;
+    size_t capacity; // in floats
+    int in_use;
+} Buffer;
+
+Buffer buffers[MAX_BUFFERS];
+pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// @brief Get a cache aligned buffer of at least `floats` floats. Its contents are undefined
+/// @param floats
+/// @return
+float* acquire_buffer(size_t floats){
+    Buffer* best = NULL;
+
+    pthread_mutex_lock(&buffers_lock);
+
+    // smallest free buffer that is big enough, or else any free slot
+    for(int i = 0; i < MAX_BUFFERS; ++i){
+        Buffer* b = buffers + i;
+
+        if(b->in_use || ((b->data != NULL) && (b->capacity < floats))) continue;
+
+        if((best == NULL) || (best->data == NULL) || ((b->data != NULL) && (b->capacity < best->capacity))){
+            best = b;
+        }
+    }
+
+    if(best == NULL){
+        // every slot is taken, replace the smallest free buffer
+        for(int i = 0; i < MAX_BUFFERS; ++i){
+            if(!buffers[i].in_use && ((best == NULL) || (buffers[i].capacity < best->capacity))){
+                best = buffers + i;
+            }
+        }
+
+        if(best == NULL){
+            printf("[ERROR] more than %d buffers in use!\n", MAX_BUFFERS);
+            exit(-1);
+        }
+
+        free(best->data);
+        best->data = NULL;
+    }
+
+    if(best->data == NULL){
+        // aligned_alloc needs a multiple of the alignment
+        size_t bytes = (sizeof(float) * floats + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+
+        best->data = (float*)aligned_alloc(CACHE_LINE, bytes);
+        best->capacity = bytes / sizeof(float);
+        assert(best->data != NULL);
+    }
+
+    best->in_use = 1;
+
+    pthread_mutex_unlock(&buffers_lock);
+
+    return best->data;
+}
+
+/// @brief Hand a buffer from `acquire_buffer` back to the pool
+void release_buffer(float* data){
+    pthread_mutex_lock(&buffers_lock);
+
+    for(int i = 0; i < MAX_BUFFERS; ++i){
+        if(buffers[i].data == data){
+            buffers[i].in_use = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&buffers_lock);
+}
+
+void free_buffers(){
+    for(int i = 0; i < MAX_BUFFERS; ++i){
+        free(buffers[i].data);
+        buffers[i] = (Buffer){0};
+    }
+}
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "hash.h"
+
+/*
+    On disk render cache. Encoded images are stored in a directory under a name made of the canonical hash of the AST,
+    see hash.h, and everything else that changes the bytes: the image size, the grid it was sampled on, normalization and
+    the format. The prompt, batch jobs and the render server look images up before rendering and store what they render.
+
+    When the files add up to more than the cap, the least recently used are deleted. Hits touch the file's modification
+    time, so the order survives restarts. Files are written to a temporary name then renamed, so a crash never leaves
+    a truncated image behind a valid name. Batch jobs store from pool threads, so every call takes the cache's lock.
+*/
+
+#define CACHE_DEFAULT_MB 256
+#define CACHE_NAME_SIZE 64
+
+typedef struct {
+    char name[CACHE_NAME_SIZE];
+    size_t bytes;
+    double used_ns; // wall clock, like file times
+} Cache_entry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int enabled;
+    char dir[256];
+    size_t cap;
+    size_t bytes;
+
+    Cache_entry* entries;
+    size_t n_entries;
+    size_t capacity;
+
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+} Render_cache;
+
+Render_cache cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+double wall_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/// @brief Name an image is cached under
+/// @param name at least `CACHE_NAME_SIZE` bytes
+/// @param hash of the AST, from `ast_hash`
+/// @param size of the image
+/// @param grid size it was sampled on
+/// @param normalize
+/// @param format file extension
+void cache_name(char* name, U64 hash, int size, int grid, int normalize, const char* format){
+    snprintf(name, CACHE_NAME_SIZE, "%016llx_%d_%d%s.%s", (unsigned long long)hash, size, grid, normalize ? "n" : "", format);
+}
+
+/// @brief Read the whole file at `path` into `t`
+/// @return -1 if it couldn't be read
+int read_file(const char* path, Text* t){
+    FILE* f = fopen(path, "rb");
+
+    if(f == NULL){
+        return -1;
+    }
+
+    char buffer[65536];
+    size_t n;
+
+    while((n = fread(buffer, 1, sizeof(buffer), f)) > 0){
+        text_append(t, buffer, n);
+    }
+
+    int failed = ferror(f);
+    fclose(f);
+
+    return failed ? -1 : 0;
+}
+
+/// @brief Write `length` bytes to a temporary file next to `path`, then rename it to `path`
+int write_file(const char* path, const void* data, size_t length){
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE* f = fopen(tmp, "wb");
+
+    if(f == NULL){
+        return -1;
+    }
+
+    int failed = fwrite(data, 1, length, f) != length;
+    failed |= fclose(f) != 0;
+
+    if(failed || (rename(tmp, path) != 0)){
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+void cache_path(char* path, size_t size, const char* name){
+    snprintf(path, size, "%s/%s", cache.dir, name);
+}
+
+Cache_entry* find_entry(const char* name){
+    for(size_t i = 0; i < cache.n_entries; ++i){
+        if(!strcmp(cache.entries[i].name, name)) return cache.entries + i;
+    }
+
+    return NULL;
+}
+
+void add_entry(const char* name, size_t bytes, double used_ns){
+    if(cache.n_entries == cache.capacity){
+        cache.capacity = cache.capacity ? cache.capacity * 2 : 64;
+        cache.entries = (Cache_entry*)realloc(cache.entries, sizeof(Cache_entry) * cache.capacity);
+        assert(cache.entries != NULL);
+    }
+
+    Cache_entry* e = cache.entries + cache.n_entries++;
+
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    e->bytes = bytes;
+    e->used_ns = used_ns;
+    cache.bytes += bytes;
+}
+
+void remove_entry(Cache_entry* e){
+    cache.bytes -= e->bytes;
+    *e = cache.entries[--cache.n_entries];
+}
+
+/// @brief Delete least recently used images until the cache fits its cap. Called with the lock held
+void evict(){
+    while((cache.bytes > cache.cap) && cache.n_entries){
+        Cache_entry* oldest = cache.entries;
+
+        for(size_t i = 1; i < cache.n_entries; ++i){
+            if(cache.entries[i].used_ns < oldest->used_ns) oldest = cache.entries + i;
+        }
+
+        char path[512];
+        cache_path(path, sizeof(path), oldest->name);
+
+        unlink(path);
+        remove_entry(oldest);
+        cache.evictions++;
+    }
+}
+
+void free_cache(){
+    pthread_mutex_lock(&cache.lock);
+
+    free(cache.entries);
+    cache.entries = NULL;
+    cache.n_entries = cache.capacity = cache.bytes = 0;
+    cache.enabled = 0;
+
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/// @brief Cache renders in `dir`, creating it if needed, and index the images already there
+/// @param dir
+/// @param cap_mb
+/// @return
+int open_cache(const char* dir, size_t cap_mb){
+    free_cache();
+
+    if((mkdir(dir, 0755) != 0) && (errno != EEXIST)){
+        printf("[ERROR] could not create cache directory %s\n", dir);
+        return -1;
+    }
+
+    DIR* d = opendir(dir);
+
+    if(d == NULL){
+        printf("[ERROR] could not open cache directory %s\n", dir);
+        return -1;
+    }
+
+    pthread_mutex_lock(&cache.lock);
+
+    snprintf(cache.dir, sizeof(cache.dir), "%s", dir);
+    cache.cap = cap_mb << 20;
+    cache.hits = cache.misses = cache.evictions = 0;
+
+    struct dirent* ent;
+
+    while((ent = readdir(d)) != NULL){
+        char path[512];
+        struct stat st;
+        size_t length = strlen(ent->d_name);
+
+        cache_path(path, sizeof(path), ent->d_name);
+
+        if((stat(path, &st) != 0) || !S_ISREG(st.st_mode) || (length >= CACHE_NAME_SIZE)){
+            continue;
+        }
+
+        // left behind by a write that didn't finish
+        if((length > 4) && !strcmp(ent->d_name + length - 4, ".tmp")){
+            unlink(path);
+            continue;
+        }
+
+        add_entry(ent->d_name, st.st_size, (double)st.st_mtim.tv_sec * 1e9 + (double)st.st_mtim.tv_nsec);
+    }
+
+    closedir(d);
+
+    cache.enabled = 1;
+    evict();
+
+    pthread_mutex_unlock(&cache.lock);
+
+    return 0;
+}
+
+/// @brief Look up an image
+/// @param name from `cache_name`
+/// @param t the image is appended to it on a hit
+/// @return -1 on a miss, or if the cache is off
+int cache_read(const char* name, Text* t){
+    pthread_mutex_lock(&cache.lock);
+
+    if(!cache.enabled){
+        pthread_mutex_unlock(&cache.lock);
+        return -1;
+    }
+
+    Cache_entry* e = find_entry(name);
+    char path[512];
+    size_t start = t->used;
+
+    cache_path(path, sizeof(path), name);
+
+    if((e != NULL) && (read_file(path, t) != 0)){
+        // deleted from under us
+        remove_entry(e);
+        e = NULL;
+        t->used = start;
+    }
+
+    if(e == NULL){
+        cache.misses++;
+        pthread_mutex_unlock(&cache.lock);
+        return -1;
+    }
+
+    e->used_ns = wall_ns();
+    utimensat(AT_FDCWD, path, NULL, 0);
+    cache.hits++;
+
+    pthread_mutex_unlock(&cache.lock);
+
+    return 0;
+}
+
+/// @brief Store an image, evicting others if the cache goes over its cap. Does nothing if the cache is off
+/// @param name from `cache_name`
+/// @param data
+/// @param length
+void cache_write(const char* name, const void* data, size_t length){
+    pthread_mutex_lock(&cache.lock);
+
+    if(!cache.enabled || (length > cache.cap)){
+        pthread_mutex_unlock(&cache.lock);
+        return;
+    }
+
+    char path[512];
+    cache_path(path, sizeof(path), name);
+
+    if(write_file(path, data, length) != 0){
+        printf("[ERROR] could not write %s to the render cache\n", name);
+
+    } else {
+        Cache_entry* e = find_entry(name);
+        if(e != NULL) remove_entry(e);
+
+        add_entry(name, length, wall_ns());
+        evict();
+    }
+
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/// @brief Copy a cached image to `path`
+/// @return -1 on a miss
+int cache_fetch(const char* name, const char* path){
+    Text t = {0};
+    int result = cache_read(name, &t);
+
+    if((result == 0) && (write_file(path, t.data, t.used) != 0)){
+        printf("[ERROR] could not write %s\n", path);
+        result = -1;
+    }
+
+    free(t.data);
+
+    return result;
+}
+
+/// @brief Store the image just written to `path`
+void cache_store(const char* name, const char* path){
+    Text t = {0};
+
+    if(cache.enabled && (read_file(path, &t) == 0)){
+        cache_write(name, t.data, t.used);
+    }
+
+    free(t.data);
+}
+
+void print_cache(){
+    pthread_mutex_lock(&cache.lock);
+
+    if(!cache.enabled){
+        printf("Render cache off\n");
+    } else {
+        printf("Render cache in %s: %zu images, %.1f of %zu MB, %zu hits, %zu misses, %zu evicted\n", cache.dir, cache.n_entries,
+            cache.bytes / 1048576.0, cache.cap >> 20, cache.hits, cache.misses, cache.evictions);
+    }
+
+    pthread_mutex_unlock(&cache.lock);
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include "ast.h"
+
+/*
+    Type check, run once after an AST is built. Channels must be made only of numeric nodes, and the root must be an E
+    or an if-then-else whose branches are roots themselves. Once this passes, ASTs are evaluated by `eval_number` and
+    `eval_rgb` without checking any result.
+*/
+
+/// @brief Check that the subtree at `index` evaluates to a number
+/// @param index
+/// @return 0 if it does
+int check_channel(size_t index){
+    Node* n = ast.array + index;
+    Node_kind nk = node_kind(n);
+
+    if(nk & NK_TRIPLE){
+        print_node_loc(index);
+        printf("cannot evaluate to a number!\n");
+        return -1;
+
+    } else if (nk & NK_UNOP){
+        return check_channel(n->as.unop);
+
+    } else if (nk & NK_BINOP){
+        return check_channel(n->as.binop.lhs) || check_channel(n->as.binop.rhs);
+
+    } else if (nk & NK_TERNOP){
+        return check_channel(n->as.triple.first) || check_channel(n->as.triple.second) || check_channel(n->as.triple.third);
+    }
+
+    return 0;
+}
+
+/// @brief Check that the AST rooted at `index` evaluates to an E of numbers for every pixel
+/// @param index
+/// @return 0 if it does
+int check_ast(size_t index){
+    Node* n = ast.array + index;
+    Node_kind nk = node_kind(n);
+
+    if(nk == NK_E){
+        return check_channel(n->as.triple.first) || check_channel(n->as.triple.second) || check_channel(n->as.triple.third);
+
+    } else if (nk == NK_IF_THEN_ELSE){
+        return check_channel(n->as.triple.first) || check_ast(n->as.triple.second) || check_ast(n->as.triple.third);
+    }
+
+    print_node_loc(index);
+    printf("Final output from AST must be E!\n");
+
+    return -1;
+}
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef COST_H
+#define COST_H
+
+#include <stdio.h>
+#include <time.h>
+#include "ast.h"
+#include "interpreter.h"
+#include "poly.h"
+#include "symmetry.h"
+
+#define PIXEL_OVERHEAD_NS 6.0 // quantization and canvas write per pixel
+#define BRANCH_SAMPLES 16 // grid used to estimate if-then-else branch probabilities
+#define RENDER_BUDGET_MS 3000.0
+#define MIN_RENDER_SIZE 64
+
+typedef enum {
+    DEP_CONST = 0,
+    DEP_X = set_bit(0),
+    DEP_Y = set_bit(1),
+    DEP_XY = DEP_X | DEP_Y
+} Dep;
+
+typedef struct {
+    float ns_per_pixel;
+    float by_dep[4]; // expected ns per pixel spent in nodes of each dependency class
+    size_t nodes;
+} Cost;
+
+typedef struct {
+    int size; // resolution the AST is sampled at, upscaled to IMAGE_SIZE
+    int refuse;
+} Render_plan;
+
+/// @brief Cost of evaluating one node of each kind in ns, indexed by `node_kind_index`. Measured with `calibrate_cost_model`, these are the defaults
+float node_cost_ns[N_NODE_KINDS] = {
+    [node_kind_index(NK_X)] = 5.0,
+    [node_kind_index(NK_Y)] = 5.0,
+    [node_kind_index(NK_NUMBER)] = 2.0,
+    [node_kind_index(NK_SIN)] = 15.0,
+    [node_kind_index(NK_COS)] = 15.0,
+    [node_kind_index(NK_EXP)] = 14.0,
+    [node_kind_index(NK_ADD)] = 8.0,
+    [node_kind_index(NK_MULT)] = 8.0,
+    [node_kind_index(NK_MOD)] = 14.0,
+    [node_kind_index(NK_DIV)] = 9.0,
+    [node_kind_index(NK_GEQ)] = 7.0,
+    [node_kind_index(NK_E)] = 5.0,
+    [node_kind_index(NK_IF_THEN_ELSE)] = 4.0,
+    [node_kind_index(NK_FMA)] = 9.0,
+    [node_kind_index(NK_AFFINE_X)] = 6.0,
+    [node_kind_index(NK_AFFINE_Y)] = 6.0,
+};
+
+const char* dep_names[4] = {"constant", "x", "y", "xy"};
+
+/// @brief Fraction of the [-1, 1] square on which the condition at `index` is true, sampled on a coarse grid
+/// @param index
+/// @param dep dependency class of the condition, a constant condition only needs one sample
+/// @return
+float branch_probability(size_t index, Dep dep){
+    int samples = (dep == DEP_CONST) ? 1 : BRANCH_SAMPLES;
+    int taken = 0;
+
+    for(int j = 0; j < samples; ++j){
+        for(int i = 0; i < samples; ++i){
+            float x = ((float)i / (float)samples) * 2.0 - 1.0;
+            float y = ((float)j / (float)samples) * 2.0 - 1.0;
+
+            taken += eval_number(ast.array, index, x, y, 0) != 0;
+        }
+    }
+
+    return (float)taken / (float)(samples * samples);
+}
+
+/// @brief Walk the AST accumulating the expected per pixel cost of each node, weighted by the probability that it is evaluated
+/// @param index
+/// @param weight probability that this node is evaluated for a given pixel
+/// @param c
+/// @return dependency class of the subtree
+Dep analyse_node(size_t index, float weight, Cost* c){
+    Node* n = ast.array + index;
+    Dep dep;
+
+    c->nodes++;
+
+    switch(node_kind(n)){
+        case NK_X: dep = DEP_X; break;
+        case NK_Y: dep = DEP_Y; break;
+        case NK_NUMBER: dep = DEP_CONST; break;
+        case NK_AFFINE_X: dep = DEP_X; break;
+        case NK_AFFINE_Y: dep = DEP_Y; break;
+
+        case NK_SIN:
+        case NK_COS:
+        case NK_EXP:
+            dep = analyse_node(n->as.unop, weight, c);
+            break;
+
+        case NK_ADD:
+        case NK_MULT:
+        case NK_MOD:
+        case NK_DIV:
+        case NK_GEQ:
+            dep = analyse_node(n->as.binop.lhs, weight, c) | analyse_node(n->as.binop.rhs, weight, c);
+            break;
+
+        case NK_FMA:
+            dep = analyse_node(n->as.triple.first, weight, c) | analyse_node(n->as.triple.second, weight, c) |
+                analyse_node(n->as.triple.third, weight, c);
+            break;
+
+        case NK_E: {
+            uint32_t channels[3] = {n->as.triple.first, n->as.triple.second, n->as.triple.third};
+            dep = DEP_CONST;
+
+            for(int i = 0; i < 3; ++i){
+                Poly p;
+
+                // when the E is the root, polynomial channels are rendered with forward differences, see `render_image`
+                if((index == ast.ast_root) && !expand_poly(channels[i], &p)){
+                    Dep channel = analyse_node(channels[i], 0, c);
+
+                    c->by_dep[channel] += weight * POLY_NS_PER_DEGREE * p.degree_x;
+                    dep |= channel;
+
+                } else if (index == ast.ast_root){
+                    // symmetric channels are only evaluated on half or a quarter of the image
+                    float share = ((node_parity(channels[i], NK_X) == PAR_NONE) ? 1.0 : 0.5) * ((node_parity(channels[i], NK_Y) == PAR_NONE) ? 1.0 : 0.5);
+
+                    dep |= analyse_node(channels[i], weight * share, c);
+
+                } else {
+                    dep |= analyse_node(channels[i], weight, c);
+                }
+            }
+            break;
+        }
+
+        case NK_IF_THEN_ELSE: {
+            Dep cond = analyse_node(n->as.triple.first, weight, c);
+            float p = branch_probability(n->as.triple.first, cond);
+
+            dep = cond | analyse_node(n->as.triple.second, weight * p, c) | analyse_node(n->as.triple.third, weight * (1.0 - p), c);
+            break;
+        }
+
+        default:
+            print_node_loc(index);
+            printf("should not be able to reach this in cost analysis!\n");
+            printf("\nkind %d\n", node_kind(n));
+            exit(-1);
+    }
+
+    c->by_dep[dep] += weight * node_cost_ns[n->op];
+
+    return dep;
+}
+
+/// @brief Predict how expensive it is to render the AST rooted at `index`
+/// @param index
+/// @return
+Cost analyse_cost(size_t index){
+    Cost c = {0};
+
+    analyse_node(index, 1.0, &c);
+
+    c.ns_per_pixel = PIXEL_OVERHEAD_NS;
+
+    for(int d = 0; d < 4; ++d){
+        c.ns_per_pixel += c.by_dep[d];
+    }
+
+    return c;
+}
+
+float predicted_ms(Cost c, int size){
+    return c.ns_per_pixel * (float)size * (float)size / 1e6;
+}
+
+void print_cost(Cost c){
+    printf("predicted cost: %.1f ns/pixel, %.1f ms at %dx%d (", c.ns_per_pixel, predicted_ms(c, IMAGE_SIZE), IMAGE_SIZE, IMAGE_SIZE);
+
+    for(int d = 0; d < 4; ++d){
+        printf("%s: %.1f%s", dep_names[d], c.by_dep[d], (d == 3) ? ")\n" : ", ");
+    }
+}
+
+/// @brief Pick the resolution to sample the AST at so that the render fits in `RENDER_BUDGET_MS`. Refuse trees that don't fit even at `MIN_RENDER_SIZE`
+/// @param c
+/// @return
+Render_plan plan_render(Cost c){
+    Render_plan plan = {.size = IMAGE_SIZE, .refuse = 0};
+
+    while((predicted_ms(c, plan.size) > RENDER_BUDGET_MS) && (plan.size > MIN_RENDER_SIZE)){
+        plan.size /= 2;
+    }
+
+    plan.refuse = predicted_ms(c, plan.size) > RENDER_BUDGET_MS;
+
+    return plan;
+}
+
+/// @brief Time evaluation of the AST currently held in `ast` over a grid of points. Best of a few runs, to filter out noise
+/// @return average ns per evaluation
+double time_eval(){
+    const int samples = 128;
+    double best = INFINITY;
+    float rgb[3];
+
+    ast.size = ast.used;
+    reallocate_ast_after_build();
+
+    for(int run = 0; run < 5; ++run){
+        double start = now_ns();
+
+        for(int j = 0; j < samples; ++j){
+            for(int i = 0; i < samples; ++i){
+                eval_rgb(ast.array, ast.size - 1, ((float)i / samples) * 2.0 - 1.0, ((float)j / samples) * 2.0 - 1.0, 0, rgb);
+            }
+        }
+
+        best = fmin(best, (now_ns() - start) / (samples * samples));
+    }
+
+    return best;
+}
+
+/// @brief Re-measure `node_cost_ns` on this machine. Each operator is timed inside `E(op(y, ...), x, x)` against the `E(x, x, x)` baseline,
+/// less the leaves it adds. Fused kinds are timed as `fma(y, y, y)` and an affine leaf in y, so they are priced on the same scale
+void calibrate_cost_model(){
+    const struct { Node_kind nk; const char* name; } ops[] = {
+        {NK_SIN, "sin"}, {NK_COS, "cos"}, {NK_EXP, "exp"}, {NK_ADD, "add"}, {NK_MULT, "mult"}, {NK_MOD, "mod"},
+        {NK_DIV, "div"}, {NK_GEQ, "geq"}, {NK_FMA, "fma"}, {NK_AFFINE_Y, "affine"},
+    };
+
+    Ast saved = ast;
+    ast = (Ast){0};
+    init_ast(20);
+
+    node_triple(NK_E, node_x, node_x, node_x);
+    double baseline = time_eval();
+
+    // the baseline is made of one E and three leaves, split it evenly
+    float leaf = baseline / 4;
+    node_cost_ns[node_kind_index(NK_X)] = leaf;
+    node_cost_ns[node_kind_index(NK_Y)] = leaf;
+    node_cost_ns[node_kind_index(NK_E)] = leaf;
+
+    for(size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i){
+        Node_kind nk = ops[i].nk;
+        size_t arg;
+        int leaves; // y leaves under the op, one of them stands in for the x it replaces
+
+        reset_ast();
+
+        if(nk & NK_UNOP){
+            arg = node_unop(nk, node_y);
+            leaves = 1;
+        } else if (nk & NK_BINOP){
+            arg = node_binop(nk, node_y, node_y);
+            leaves = 2;
+        } else if (nk == NK_FMA){
+            arg = node_fma(node_y, node_y, node_y);
+            leaves = 3;
+        } else {
+            arg = node_affine(nk, 0.5, 0.25);
+            leaves = 0;
+        }
+
+        node_triple(NK_E, arg, node_x, node_x);
+
+        double extra = time_eval() - baseline - (leaves - 1) * leaf;
+        node_cost_ns[node_kind_index(nk)] = fmax(extra, 0.5);
+    }
+
+    node_cost_ns[node_kind_index(NK_AFFINE_X)] = node_cost_ns[node_kind_index(NK_AFFINE_Y)];
+
+    free_ast();
+    ast = saved;
+
+    printf("Calibrated node costs (ns): leaf %.1f", leaf);
+    for(size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i){
+        printf(", %s %.1f", ops[i].name, node_cost_ns[node_kind_index(ops[i].nk)]);
+    }
+    printf("\n\n");
+}
+
+#endif
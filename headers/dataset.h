@@ -0,0 +1,549 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "serialize.h"
+#include "search.h"
+#include "render.h"
+
+/*
+    Dataset output, for training corpora of (AST, image) pairs that are too many to write as a png each. Records are
+    appended to shards of about `DATASET_SHARD_MB`, and each shard gets an index that can be mapped and searched by seed:
+
+        <prefix>_<shard>.pack   a `Pack_header`, then records: a `Dataset_record`, the packed AST (see serialize.h), pixels
+        <prefix>_<shard>.index  an `Index_header`, then a `Dataset_entry` for every record of the shard, sorted by seed
+
+    Pixels are `size` x `size` 8 bit RGB, raw or as a png. The three stages overlap: seeds are generated on the main thread,
+    since generation depends on the global `rand` state, and rendered as batch jobs of the scheduler, whose done callback
+    encodes the record on the pool thread that finished it. A writer thread appends records to the shard in the order
+    they finish. At most `DATASET_IN_FLIGHT` records are between generation and the disk, so a slow disk holds back
+    generation rather than filling memory. Indexes are written when their shard is full, to a temporary name then renamed,
+    so a shard with an index is always whole.
+*/
+
+#define DATASET_SHARD_MB 256
+#define DATASET_IN_FLIGHT 16
+
+#define PACK_MAGIC "RAPK"
+#define INDEX_MAGIC "RAIX"
+#define DATASET_VERSION 1
+
+typedef enum {
+    PF_RAW,
+    PF_PNG
+} Pixel_format;
+
+const char* pixel_format_names[] = {"raw", "png"};
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+} Pack_header;
+
+typedef struct {
+    U64 seed;
+    uint32_t depth;
+    uint32_t size;
+    uint32_t format; // `Pixel_format`
+    uint32_t ast_bytes;
+    uint32_t pixel_bytes;
+    uint32_t reserved;
+} Dataset_record;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+} Index_header;
+
+typedef struct {
+    U64 seed;
+    U64 offset; // of its `Dataset_record` in the shard
+    U64 bytes; // of the record, header included
+} Dataset_entry;
+
+/// @brief A record on its way through the pipeline
+typedef struct Dataset_job {
+    Render r;
+    Node* nodes; // snapshot of the AST
+    Text record; // the header and packed AST when it is queued, the pixels are added once it is rendered
+    struct Dataset_job* next;
+} Dataset_job;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // for the writer, when a record is queued
+    pthread_cond_t room; // for generation, when a record has been written
+
+    Dataset_job* head;
+    Dataset_job* tail;
+    int in_flight;
+    int finished; // no more records will be queued
+
+    char prefix[128];
+    Pixel_format format;
+
+    FILE* shard;
+    int n_shards;
+    size_t shard_bytes;
+    Dataset_entry* entries; // of the shard being written
+    size_t n_entries;
+    size_t capacity;
+
+    size_t records;
+    size_t bytes;
+    int failed;
+} Dataset;
+
+Dataset dataset = {.lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER, .room = PTHREAD_COND_INITIALIZER};
+
+int compare_entries(const void* a, const void* b){
+    U64 x = ((const Dataset_entry*)a)->seed, y = ((const Dataset_entry*)b)->seed;
+
+    return (x > y) - (x < y);
+}
+
+void shard_path(char* path, size_t size, int shard, const char* extension){
+    snprintf(path, size, "%s_%04d.%s", dataset.prefix, shard, extension);
+}
+
+/// @brief Write the index of the shard being written and close it
+void close_shard(){
+    char path[192];
+    Index_header header = {.magic = INDEX_MAGIC, .version = DATASET_VERSION, .count = dataset.n_entries};
+
+    if(dataset.shard == NULL){
+        return;
+    }
+
+    if(fclose(dataset.shard) != 0){
+        dataset.failed = 1;
+    }
+
+    dataset.shard = NULL;
+
+    qsort(dataset.entries, dataset.n_entries, sizeof(Dataset_entry), compare_entries);
+
+    shard_path(path, sizeof(path), dataset.n_shards - 1, "index");
+
+    Text t = {0};
+    text_append(&t, &header, sizeof(header));
+    text_append(&t, dataset.entries, sizeof(Dataset_entry) * dataset.n_entries);
+
+    if(write_file(path, t.data, t.used) != 0){
+        printf("[ERROR] could not write %s\n", path);
+        dataset.failed = 1;
+    }
+
+    free(t.data);
+    dataset.n_entries = 0;
+}
+
+/// @brief Append a record to the shard being written, starting a new one if it is full
+void write_record(const Text* record){
+    char path[192];
+    Pack_header header = {.magic = PACK_MAGIC, .version = DATASET_VERSION};
+
+    if((dataset.shard != NULL) && (dataset.shard_bytes + record->used > ((size_t)DATASET_SHARD_MB << 20))){
+        close_shard();
+    }
+
+    if(dataset.shard == NULL){
+        shard_path(path, sizeof(path), dataset.n_shards, "pack");
+        dataset.shard = fopen(path, "wb");
+
+        if(dataset.shard == NULL){
+            printf("[ERROR] could not create %s\n", path);
+            dataset.failed = 1;
+            return;
+        }
+
+        dataset.n_shards++;
+        dataset.shard_bytes = fwrite(&header, 1, sizeof(header), dataset.shard);
+    }
+
+    if(dataset.n_entries == dataset.capacity){
+        dataset.capacity = dataset.capacity ? dataset.capacity * 2 : 1024;
+        dataset.entries = (Dataset_entry*)realloc(dataset.entries, sizeof(Dataset_entry) * dataset.capacity);
+        assert(dataset.entries != NULL);
+    }
+
+    Dataset_record r;
+    memcpy(&r, record->data, sizeof(r));
+
+    dataset.entries[dataset.n_entries++] = (Dataset_entry){.seed = r.seed, .offset = dataset.shard_bytes, .bytes = record->used};
+
+    if(fwrite(record->data, 1, record->used, dataset.shard) != record->used){
+        dataset.failed = 1;
+    }
+
+    dataset.shard_bytes += record->used;
+    dataset.records++;
+    dataset.bytes += record->used;
+}
+
+/// @brief Writer thread, appends records as they are queued until generation has finished and every record is written
+void* dataset_writer(void* arg){
+    (void)arg;
+
+    pthread_mutex_lock(&dataset.lock);
+
+    for(;;){
+        while((dataset.head == NULL) && !(dataset.finished && (dataset.in_flight == 0))){
+            pthread_cond_wait(&dataset.ready, &dataset.lock);
+        }
+
+        Dataset_job* job = dataset.head;
+
+        if(job == NULL){
+            break;
+        }
+
+        dataset.head = job->next;
+        if(dataset.head == NULL) dataset.tail = NULL;
+
+        // the shard is only touched by this thread
+        pthread_mutex_unlock(&dataset.lock);
+
+        if(job->record.used){
+            write_record(&job->record);
+        }
+
+        free(job->record.data);
+        free(job);
+
+        pthread_mutex_lock(&dataset.lock);
+        dataset.in_flight--;
+        pthread_cond_signal(&dataset.room);
+    }
+
+    pthread_mutex_unlock(&dataset.lock);
+
+    close_shard();
+
+    return NULL;
+}
+
+/// @brief Add the pixels of a rendered record, on the pool thread that finished it, and hand it to the writer. Cancelled
+/// @brief records are handed over empty, so they are still counted out of the pipeline
+void dataset_render_done(void* ctx, int cancelled){
+    Dataset_job* job = (Dataset_job*)ctx;
+    Dataset_record header;
+    int size = job->r.size * job->r.scale;
+
+    finish_render(&job->r, NULL);
+
+    memcpy(&header, job->record.data, sizeof(header));
+
+    if(cancelled){
+        job->record.used = 0;
+
+    } else if(dataset.format == PF_PNG){
+        int length;
+        unsigned char* png = stbi_write_png_to_mem((const unsigned char*)*job->r.canvas, sizeof(Pixel) * IMAGE_SIZE, size, size, 4, &length);
+        assert(png != NULL);
+
+        text_append(&job->record, png, length);
+        header.pixel_bytes = length;
+        free(png);
+
+    } else {
+        text_reserve(&job->record, (size_t)size * size * 3);
+        char* rgb = job->record.data + job->record.used;
+
+        for(int y = 0; y < size; ++y){
+            for(int x = 0; x < size; ++x){
+                Pixel p = job->r.canvas[y][x];
+
+                *rgb++ = p.r;
+                *rgb++ = p.g;
+                *rgb++ = p.b;
+            }
+        }
+
+        job->record.used += (size_t)size * size * 3;
+
+        header.pixel_bytes = size * size * 3;
+    }
+
+    if(job->record.used){
+        memcpy(job->record.data, &header, sizeof(header));
+    }
+
+    free(job->r.canvas);
+    free(job->nodes);
+
+    pthread_mutex_lock(&dataset.lock);
+
+    if(dataset.tail == NULL){
+        dataset.head = job;
+    } else {
+        dataset.tail->next = job;
+    }
+
+    dataset.tail = job;
+    pthread_cond_signal(&dataset.ready);
+
+    pthread_mutex_unlock(&dataset.lock);
+}
+
+/// @brief Queue the render of the AST held in `ast` as a record of `seed`, once there is room in the pipeline
+void submit_record(U64 seed, int depth, int size, int grid){
+    Dataset_job* job = (Dataset_job*)calloc(1, sizeof(Dataset_job));
+    assert(job != NULL);
+
+    Dataset_record header = {.seed = seed, .depth = depth, .size = size, .format = dataset.format};
+
+    text_append(&job->record, &header, sizeof(header));
+    pack_ast(&job->record);
+    ((Dataset_record*)job->record.data)->ast_bytes = job->record.used - sizeof(header);
+
+    job->nodes = (Node*)malloc(sizeof(Node) * ast.size);
+    assert(job->nodes != NULL);
+    memcpy(job->nodes, ast.array, sizeof(Node) * ast.size);
+
+    // one canvas pixel per image pixel, rows are still `IMAGE_SIZE` wide
+    job->r = (Render){.nodes = job->nodes, .size = grid, .scale = size / grid};
+    job->r.canvas = (Pixel (*)[IMAGE_SIZE])malloc(sizeof(Pixel) * IMAGE_SIZE * size);
+    assert(job->r.canvas != NULL);
+
+    prepare_render(&job->r, 0);
+
+    pthread_mutex_lock(&dataset.lock);
+
+    while(dataset.in_flight >= DATASET_IN_FLIGHT){
+        pthread_cond_wait(&dataset.room, &dataset.lock);
+    }
+
+    dataset.in_flight++;
+
+    pthread_mutex_unlock(&dataset.lock);
+
+    char name[64];
+    snprintf(name, sizeof(name), "dataset seed %llu", (unsigned long long)seed);
+
+    sched_submit(PRIO_BATCH, name, job, render_next_phase, render_unit, dataset_render_done);
+}
+
+/// @brief Generate, render and write the records of seeds `first` to `last` to shards named `dataset_<first>_<last>_d<depth>_<size>_<format>`,
+/// @brief see the comment at the top of dataset.h. Returns once every record is written
+/// @param first
+/// @param last
+/// @param depth
+/// @param size of the images, a power of 2 from `TILE_SIZE` to `IMAGE_SIZE`. Expensive ASTs are sampled on a smaller grid, as
+/// @param size they are for batch renders
+/// @param format
+/// @return 0 if every record was written
+int write_dataset(U64 first, U64 last, int depth, int size, Pixel_format format){
+    pthread_t writer;
+    int skipped = 0;
+    double start_ns = now_ns();
+
+    snprintf(dataset.prefix, sizeof(dataset.prefix), "dataset_%llu_%llu_d%d_%d_%s", (unsigned long long)first, (unsigned long long)last, depth, size,
+        pixel_format_names[format]);
+    dataset.format = format;
+    dataset.finished = dataset.failed = 0;
+    dataset.n_shards = 0;
+    dataset.records = dataset.bytes = 0;
+
+    init_pool();
+
+    if(pthread_create(&writer, NULL, dataset_writer, NULL) != 0){
+        printf("[ERROR] could not start the dataset writer\n");
+        return -1;
+    }
+
+    for(U64 s = first; s <= last; ++s){
+        Render_plan plan = (build_seed(s, depth, 0) == 0) ? plan_render(analyse_cost(ast.ast_root)) : (Render_plan){.refuse = 1};
+
+        if(plan.refuse){
+            skipped++;
+        } else {
+            // `plan.size` is the grid for an `IMAGE_SIZE` image
+            int grid = plan.size * size / IMAGE_SIZE;
+
+            submit_record(s, depth, size, (grid < TILE_SIZE) ? TILE_SIZE : grid);
+        }
+
+        if(s == last) break; // the range may end at the largest seed
+    }
+
+    pthread_mutex_lock(&dataset.lock);
+    dataset.finished = 1;
+    pthread_cond_signal(&dataset.ready);
+    pthread_mutex_unlock(&dataset.lock);
+
+    pthread_join(writer, NULL);
+
+    free(dataset.entries);
+    dataset.entries = NULL;
+    dataset.capacity = 0;
+
+    double seconds = (now_ns() - start_ns) / 1e9;
+
+    printf("Wrote %zu records, %.1f MB, to %d shards %s_*.pack in %.2f s (%.1f records/s)", dataset.records, dataset.bytes / 1048576.0,
+        dataset.n_shards, dataset.prefix, seconds, dataset.records / seconds);
+
+    if(skipped){
+        printf(", skipped %d seeds with invalid or too expensive ASTs", skipped);
+    }
+
+    printf("\n");
+
+    if(dataset.failed){
+        printf("[ERROR] some records could not be written\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+typedef struct {
+    const Dataset_entry* entries;
+    uint32_t count;
+
+    void* map;
+    size_t map_size;
+} Dataset_index;
+
+/// @brief Map a shard index, see `write_dataset`
+/// @param path
+/// @param index
+/// @return 0 if it is a valid index
+int map_dataset_index(const char* path, Dataset_index* index){
+    struct stat st;
+    Index_header header;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0){
+        printf("[ERROR] could not open %s\n", path);
+        return -1;
+    }
+
+    if((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(header))){
+        printf("[ERROR] %s is not a dataset index\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(map == MAP_FAILED){
+        printf("[ERROR] could not map %s\n", path);
+        return -1;
+    }
+
+    memcpy(&header, map, sizeof(header));
+
+    if(memcmp(header.magic, INDEX_MAGIC, 4) || (header.version != DATASET_VERSION) ||
+        (sizeof(header) + (size_t)header.count * sizeof(Dataset_entry) != (size_t)st.st_size)){
+
+        printf("[ERROR] %s is not a dataset index of version %d\n", path, DATASET_VERSION);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    *index = (Dataset_index){.entries = (const Dataset_entry*)((const Index_header*)map + 1), .count = header.count, .map = map, .map_size = st.st_size};
+
+    return 0;
+}
+
+void unmap_dataset_index(Dataset_index* index){
+    munmap(index->map, index->map_size);
+    *index = (Dataset_index){0};
+}
+
+/// @return the entry of `seed`, or NULL if it isn't in the shard
+const Dataset_entry* find_record(const Dataset_index* index, U64 seed){
+    Dataset_entry key = {.seed = seed};
+
+    return (const Dataset_entry*)bsearch(&key, index->entries, index->count, sizeof(Dataset_entry), compare_entries);
+}
+
+/// @brief Read the record of `seed` from the shard at `pack`, whose index is next to it. Its AST replaces the one held in `ast`,
+/// @brief and its image is written to `path` as a png
+/// @param pack
+/// @param seed
+/// @param path
+/// @return 0 if it was found and read
+int read_record(const char* pack, U64 seed, const char* path){
+    char index_path[192];
+    size_t length = strlen(pack);
+    Dataset_index index;
+
+    if((length < 5) || strcmp(pack + length - 5, ".pack") || (length + 1 > sizeof(index_path))){
+        printf("[ERROR] %s is not a dataset shard\n", pack);
+        return -1;
+    }
+
+    snprintf(index_path, sizeof(index_path), "%.*s.index", (int)(length - 5), pack);
+
+    if(map_dataset_index(index_path, &index) != 0){
+        return -1;
+    }
+
+    const Dataset_entry* e = find_record(&index, seed);
+    Dataset_entry entry = (e == NULL) ? (Dataset_entry){0} : *e;
+
+    unmap_dataset_index(&index);
+
+    if(e == NULL){
+        printf("[ERROR] seed %llu is not in %s\n", (unsigned long long)seed, pack);
+        return -1;
+    }
+
+    Text t = {0};
+    Dataset_record header;
+    int fd = open(pack, O_RDONLY | O_CLOEXEC);
+    int result = -1;
+
+    text_reserve(&t, entry.bytes);
+
+    if((fd >= 0) && (pread(fd, t.data, entry.bytes, entry.offset) == (ssize_t)entry.bytes) && (entry.bytes >= sizeof(header))){
+        memcpy(&header, t.data, sizeof(header));
+
+        if((header.seed == seed) && (sizeof(header) + (size_t)header.ast_bytes + header.pixel_bytes == entry.bytes)){
+            result = 0;
+        }
+    }
+
+    if(fd >= 0) close(fd);
+
+    if(result != 0){
+        printf("[ERROR] record of seed %llu in %s is damaged\n", (unsigned long long)seed, pack);
+
+    } else if(unpack_ast(t.data + sizeof(header), header.ast_bytes) != 0){
+        result = -1;
+
+    } else {
+        const char* pixels = t.data + sizeof(header) + header.ast_bytes;
+
+        if(header.format == PF_PNG){
+            result = write_file(path, pixels, header.pixel_bytes);
+        } else {
+            result = stbi_write_png(path, header.size, header.size, 3, pixels, 3 * header.size) ? 0 : -1;
+        }
+
+        if(result != 0){
+            printf("[ERROR] could not write %s\n", path);
+        } else {
+            printf("Read seed %llu at depth %u, %ux%u %s pixels, image written to %s\n", (unsigned long long)seed, header.depth,
+                header.size, header.size, pixel_format_names[header.format == PF_PNG], path);
+        }
+    }
+
+    free(t.data);
+
+    return result;
+}
+
+#endif
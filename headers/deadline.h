@@ -0,0 +1,148 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdio.h>
+#include "render.h"
+#include "cost.h"
+
+/*
+    Rendering against a deadline. A render at the smallest grid is always made first, so there is an image to return
+    however big the AST is. Then the largest grid the cost model says fits in the remaining time is attempted, and
+    abandoned as soon as the rows rendered so far project past the deadline. Every abandoned attempt corrects the cost
+    model with the time it actually took, and makes later attempts cheaper in quality as well as resolution: first sin
+    and cos are evaluated with `fast_sin`, then tiles whose range spans a few levels are filled without evaluating them.
+    The image kept is the last attempt that finished.
+*/
+
+#define DEADLINE_MAX_TOLERANCE 16 // coarsest tile culling, in 8 bit levels
+
+typedef struct {
+    int size; // grid the image was sampled on
+    int full_size; // grid it would have been sampled on without a deadline
+    int fast_math;
+    int tile_tolerance;
+    int attempts;
+    int abandoned;
+    double deadline_ms;
+    double elapsed_ms;
+} Render_report;
+
+/// @brief Render into `canvas` at `size`, with the given quality tier
+/// @return time taken in ms, or a negative time if the render was abandoned
+double deadline_attempt(Pixel (*canvas)[IMAGE_SIZE], int size, int normalize, int fast, int tolerance, double deadline_ns, Render_stats* stats, float* done){
+    Render r = {.size = size, .scale = IMAGE_SIZE / size, .canvas = canvas, .normalize = normalize, .tile_tolerance = tolerance,
+        .fast_math = fast, .deadline_ns = deadline_ns};
+
+    int result = render_canvas(&r, stats);
+
+    double ms = (now_ns() - r.start_ns) / 1e6;
+    *done = (float)r.rows_done / r.rows_total;
+
+    return (result == 0) ? ms : -ms;
+}
+
+/// @brief Render the AST to a png at `path`, finishing within `deadline_ms` if at all possible. Resolution, math precision and tile culling
+/// @brief are degraded as needed, and `report` says how
+/// @param cost of the AST, from `analyse_cost`
+/// @param path
+/// @param deadline_ms
+/// @param stats if not NULL, filled with statistics of the image written
+/// @param normalize
+/// @param report
+/// @return
+int render_with_deadline(Cost cost, const char* path, double deadline_ms, Render_stats* stats, int normalize, Render_report* report){
+    static Pixel best[IMAGE_SIZE][IMAGE_SIZE], attempt[IMAGE_SIZE][IMAGE_SIZE];
+    Render_stats attempt_stats;
+    double start = now_ns();
+    double deadline_ns = start + deadline_ms * 1e6;
+    float correction = 1.0; // measured over predicted render time
+    int fast = 0, tolerance = 0;
+    float done;
+
+    *report = (Render_report){.size = TILE_SIZE, .full_size = plan_render(cost).size, .deadline_ms = deadline_ms};
+
+    // without a deadline, so that there always is an image
+    double ms = deadline_attempt(best, TILE_SIZE, normalize, 0, 0, 0, stats, &done);
+    report->attempts++;
+
+    // smaller renders are mostly overhead
+    if(predicted_ms(cost, TILE_SIZE) > 1.0){
+        correction = ms / predicted_ms(cost, TILE_SIZE);
+    }
+
+    while(1){
+        double remaining_ms = (deadline_ns - now_ns()) / 1e6;
+        int size = report->full_size;
+
+        while((size > report->size) && (predicted_ms(cost, size) * correction > remaining_ms)){
+            size /= 2;
+        }
+
+        if(size <= report->size){
+            break;
+        }
+
+        ms = deadline_attempt(attempt, size, normalize, fast, tolerance, deadline_ns, (stats == NULL) ? NULL : &attempt_stats, &done);
+        report->attempts++;
+
+        if(ms >= 0){
+            memcpy(best, attempt, sizeof(best));
+            report->size = size;
+            report->fast_math = fast;
+            report->tile_tolerance = normalize ? 0 : tolerance; // normalized renders don't fill tiles
+
+            if(stats != NULL) *stats = attempt_stats;
+
+            correction = ms / predicted_ms(cost, size);
+            continue;
+        }
+
+        // what the whole render would have taken
+        report->abandoned++;
+        correction = (done > 0) ? -ms / done / predicted_ms(cost, size) : correction * 4;
+
+        if(!fast){
+            fast = 1;
+        } else if(tolerance < DEADLINE_MAX_TOLERANCE){
+            tolerance = tolerance ? tolerance * 2 : 2;
+        }
+    }
+
+    report->elapsed_ms = (now_ns() - start) / 1e6;
+
+    if(!stbi_write_png(path, IMAGE_SIZE, IMAGE_SIZE, 4, *best, sizeof(Pixel) * IMAGE_SIZE)){
+        printf("[ERROR] could not write image\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void print_render_report(const Render_report* report){
+    printf("Rendered in %.1f ms of %.0f ms after %d attempts, %d abandoned", report->elapsed_ms, report->deadline_ms, report->attempts, report->abandoned);
+
+    if((report->size == report->full_size) && !report->fast_math && !report->tile_tolerance){
+        printf(", not degraded\n");
+        return;
+    }
+
+    const char* separator = ", degraded to ";
+
+    if(report->size != report->full_size){
+        printf("%s%dx%d instead of %dx%d", separator, report->size, report->size, report->full_size, report->full_size);
+        separator = ", ";
+    }
+
+    if(report->fast_math){
+        printf("%sfast sin and cos", separator);
+        separator = ", ";
+    }
+
+    if(report->tile_tolerance){
+        printf("%stiles filled within %d levels", separator, report->tile_tolerance);
+    }
+
+    printf("\n");
+}
+
+#endif
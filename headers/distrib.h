@@ -0,0 +1,754 @@
+#ifndef DISTRIB_H
+#define DISTRIB_H
+
+#include <stdio.h>
+#include <poll.h>
+#include <spawn.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "serialize.h"
+#include "server.h"
+#include "render.h"
+
+/*
+    Distributed rendering. A coordinator listens on a socket, `unix:<path>` or `<host>:<port>` for TCP, and worker
+    processes connect to it, on the same machine or others. For each render the coordinator sends every worker the AST
+    once, in the binary format, then hands out bands of rows, at most `DIST_PIPELINE` per worker so that fast workers get
+    more of them. Workers send back the quantized rows, which the coordinator scales into the image.
+
+    Once every band has been handed out, idle workers are given copies of the bands that have been out the longest, and
+    whichever copy comes back first is kept, so a slow worker holds up the render by at most one band. The bands of a
+    worker that disconnects go back to the others, and if every worker is gone the coordinator renders the rest itself.
+    Samples are quantized exactly as a local render would, so the image is the same bit for bit.
+
+    Frames are those of the render server, a 32 bit big endian length, and start with a message type:
+
+        job <id> <grid size> <packed AST>, tile <job id> <first row> <rows>, rows <job id> <first row> <rows> <rgb bytes>
+*/
+
+#define DIST_MAX_WORKERS 64
+#define DIST_TILE_ROWS 16
+#define DIST_PIPELINE 2 // bands handed to a worker before it has sent any back
+#define DIST_CONNECT_MS 3000 // how long a render waits for a first worker
+#define DIST_MAX_FRAME (1 << 28)
+#define DIST_POLL_MS 100
+
+typedef enum {
+    MSG_JOB,
+    MSG_TILE,
+    MSG_ROWS
+} Dist_message;
+
+typedef struct {
+    Client c;
+    int job; // last job sent to it
+    int tiles[DIST_PIPELINE]; // bands it is rendering, -1 for none
+    int rendered; // bands it sent back first
+} Dist_worker;
+
+typedef struct {
+    char address[256];
+    int listener;
+    Dist_worker* workers[DIST_MAX_WORKERS];
+    pid_t local[DIST_MAX_WORKERS]; // worker processes started by the coordinator
+    int n_local;
+    int job;
+} Coordinator;
+
+Coordinator coord = {.listener = -1};
+
+extern char** environ;
+
+/// @brief Band of rows of a render, for the pool
+typedef struct {
+    Render* r;
+    int first;
+    int last;
+} Row_band;
+
+uint32_t get_u32(const char* p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+
+    return ntohl(v);
+}
+
+/// @brief Open a socket for `address`, `unix:<path>` or `<host>:<port>`, listening on it or connected to it
+/// @param address
+/// @param listening
+/// @return the socket, or -1
+int open_socket(const char* address, int listening){
+    int fd = -1;
+
+    if(!strncmp(address, "unix:", 5)){
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+        if(strlen(address + 5) >= sizeof(addr.sun_path)){
+            printf("[ERROR] socket path %s is too long\n", address + 5);
+            return -1;
+        }
+
+        strcpy(addr.sun_path, address + 5);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if(listening) unlink(addr.sun_path); // left behind by a coordinator that didn't shut down
+
+        int ok = (fd >= 0) && (listening ? (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) && (listen(fd, DIST_MAX_WORKERS) == 0)
+            : (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0));
+
+        if(!ok && (fd >= 0)){
+            close(fd);
+            fd = -1;
+        }
+
+        return fd;
+    }
+
+    char host[256];
+    const char* colon = strrchr(address, ':');
+
+    if((colon == NULL) || (colon - address >= (long)sizeof(host))){
+        printf("[ERROR] expected unix:<path> or <host>:<port>, got %s\n", address);
+        return -1;
+    }
+
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = listening ? AI_PASSIVE : 0};
+    struct addrinfo* found;
+
+    if(getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &found) != 0){
+        printf("[ERROR] could not resolve %s\n", address);
+        return -1;
+    }
+
+    for(struct addrinfo* a = found; (a != NULL) && (fd < 0); a = a->ai_next){
+        int one = 1;
+
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+
+        if(fd < 0) continue;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        int ok = listening ? (bind(fd, a->ai_addr, a->ai_addrlen) == 0) && (listen(fd, DIST_MAX_WORKERS) == 0)
+            : (connect(fd, a->ai_addr, a->ai_addrlen) == 0);
+
+        if(ok){
+            // rows are sent as soon as they are ready
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        } else {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    freeaddrinfo(found);
+
+    return fd;
+}
+
+void render_band(void* arg){
+    Row_band* b = (Row_band*)arg;
+
+    for(int int_y = b->first; int_y <= b->last; ++int_y){
+        render_row(b->r, int_y);
+        write_row(b->r, int_y, b->first / RENDER_BAND_ROWS);
+    }
+}
+
+/// @brief Set up `r` to render any band of rows of the AST held in `ast` on its own, on a `size` grid with one canvas pixel per sample
+void start_rows(Render* r, int size){
+    *r = (Render){.size = size, .scale = 1};
+
+    prepare_render(r, 0);
+
+    // rows mirrored along y would need rows of other bands, mirroring along x is still fine
+    r->mirror_y = 0;
+
+    for(int c = 0; c < 3; ++c){
+        r->parity_y[c] = PAR_NONE;
+    }
+
+    r->planes = acquire_buffer(3 * size * size);
+    r->canvas = (Pixel (*)[IMAGE_SIZE])malloc(sizeof(Pixel) * IMAGE_SIZE * size);
+    assert(r->canvas != NULL);
+}
+
+void stop_rows(Render* r){
+    finish_render(r, NULL);
+    free(r->canvas);
+    r->canvas = NULL;
+}
+
+/// @brief Render rows `first` to `last` into the canvas of `r`, from `start_rows`, on the pool
+void render_rows(Render* r, int first, int last){
+    Row_band bands[IMAGE_SIZE / RENDER_BAND_ROWS];
+    size_t pending = 0;
+    int n = 0;
+
+    for(int y = first; y <= last; y += RENDER_BAND_ROWS){
+        bands[n] = (Row_band){.r = r, .first = y, .last = (y + RENDER_BAND_ROWS - 1 < last) ? y + RENDER_BAND_ROWS - 1 : last};
+        pool_submit_to(&pending, render_band, bands + n);
+        n++;
+    }
+
+    pool_wait_for(&pending);
+}
+
+/// @brief Read exactly `length` bytes
+/// @return -1 if the connection closed first
+int read_full(int fd, void* data, size_t length){
+    for(size_t at = 0; at < length;){
+        ssize_t n = recv(fd, (char*)data + at, length - at, 0);
+
+        if((n < 0) && (errno == EINTR)) continue;
+        if(n <= 0) return -1;
+
+        at += n;
+    }
+
+    return 0;
+}
+
+int write_full(int fd, const void* data, size_t length){
+    for(size_t at = 0; at < length;){
+        ssize_t n = send(fd, (const char*)data + at, length - at, MSG_NOSIGNAL);
+
+        if((n < 0) && (errno == EINTR)) continue;
+        if(n <= 0) return -1;
+
+        at += n;
+    }
+
+    return 0;
+}
+
+/// @brief Render bands for the coordinator at `address` until it goes away
+/// @param address
+/// @return
+int work(const char* address){
+    int fd = open_socket(address, 0);
+
+    if(fd < 0){
+        printf("[ERROR] could not connect to coordinator at %s\n", address);
+        return -1;
+    }
+
+    printf("Working for %s\n", address);
+    fflush(stdout);
+
+    init_pool();
+
+    Render r = {0};
+    Text frame = {0}, out = {0};
+    int job = -1, bands = 0;
+
+    while(1){
+        uint32_t length;
+
+        if(read_full(fd, &length, sizeof(length)) != 0) break;
+
+        length = ntohl(length);
+
+        if((length < 3 * sizeof(uint32_t)) || (length > DIST_MAX_FRAME)){
+            printf("[ERROR] bad frame from coordinator\n");
+            break;
+        }
+
+        frame.used = 0;
+        text_reserve(&frame, length);
+
+        if(read_full(fd, frame.data, length) != 0) break;
+
+        Dist_message type = get_u32(frame.data);
+
+        if(type == MSG_JOB){
+            int size = get_u32(frame.data + 8);
+
+            if(job >= 0) stop_rows(&r);
+            job = -1;
+
+            if((size < TILE_SIZE) || (size > IMAGE_SIZE) || (size & (size - 1)) || (unpack_ast(frame.data + 12, length - 12) != 0) ||
+                (check_ast(ast.ast_root) != 0)){
+
+                printf("[ERROR] bad job from coordinator\n");
+                break;
+            }
+
+            job = get_u32(frame.data + 4);
+            start_rows(&r, size);
+            continue;
+        }
+
+        int first = get_u32(frame.data + 8), rows = (length >= 16) ? (int)get_u32(frame.data + 12) : 0;
+
+        if((type != MSG_TILE) || ((int)get_u32(frame.data + 4) != job) || (rows < 1) || (first < 0) || (first + rows > r.size)){
+            printf("[ERROR] bad band from coordinator\n");
+            break;
+        }
+
+        render_rows(&r, first, first + rows - 1);
+
+        out.used = 0;
+        put_u32(&out, 4 * sizeof(uint32_t) + (size_t)rows * r.size * 3);
+        put_u32(&out, MSG_ROWS);
+        put_u32(&out, job);
+        put_u32(&out, first);
+        put_u32(&out, rows);
+
+        for(int y = first; y < first + rows; ++y){
+            for(int x = 0; x < r.size; ++x){
+                text_append(&out, r.canvas[y] + x, 3);
+            }
+        }
+
+        if(write_full(fd, out.data, out.used) != 0) break;
+
+        bands++;
+    }
+
+    if(job >= 0) stop_rows(&r);
+
+    close(fd);
+    free(frame.data);
+    free(out.data);
+
+    printf("Rendered %d bands for %s\n", bands, address);
+
+    return 0;
+}
+
+/// @brief Start `n` worker processes of this program connecting to the coordinator, with their output thrown away
+void spawn_workers(int n){
+    for(int i = 0; (i < n) && (coord.n_local < DIST_MAX_WORKERS); ++i){
+        int in[2];
+
+        if(pipe(in) != 0){
+            printf("[ERROR] could not start worker\n");
+            return;
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, in[1]);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+        char* argv[] = {"randomart", NULL};
+        pid_t pid;
+
+        int failed = posix_spawn(&pid, "/proc/self/exe", &actions, NULL, argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(in[0]);
+
+        if(failed){
+            printf("[ERROR] could not start worker\n");
+            close(in[1]);
+            return;
+        }
+
+        // the worker reads its commands like any other run
+        char commands[300];
+        int length = snprintf(commands, sizeof(commands), "work %s\nquit\n", coord.address);
+
+        if(write(in[1], commands, length) != length){
+            printf("[ERROR] could not start worker\n");
+        }
+
+        close(in[1]);
+        coord.local[coord.n_local++] = pid;
+    }
+}
+
+void close_worker(Dist_worker* w){
+    for(int i = 0; i < DIST_MAX_WORKERS; ++i){
+        if(coord.workers[i] == w) coord.workers[i] = NULL;
+    }
+
+    close(w->c.fd);
+    free(w->c.in.data);
+    free(w->c.out.data);
+    free(w);
+}
+
+void accept_workers(){
+    int fd;
+
+    while((fd = accept(coord.listener, NULL, NULL)) >= 0){
+        int slot = 0;
+
+        while((slot < DIST_MAX_WORKERS) && (coord.workers[slot] != NULL)) slot++;
+
+        if(slot == DIST_MAX_WORKERS){
+            printf("[ERROR] more than %d workers, refusing connection\n", DIST_MAX_WORKERS);
+            close(fd);
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        Dist_worker* w = (Dist_worker*)calloc(1, sizeof(Dist_worker));
+        assert(w != NULL);
+
+        w->c.fd = fd;
+        w->job = -1;
+
+        for(int t = 0; t < DIST_PIPELINE; ++t) w->tiles[t] = -1;
+
+        coord.workers[slot] = w;
+    }
+}
+
+/// @brief Disconnect every worker, which makes local ones quit, and stop listening
+void free_coordinator(){
+    for(int i = 0; i < DIST_MAX_WORKERS; ++i){
+        if(coord.workers[i] != NULL) close_worker(coord.workers[i]);
+    }
+
+    if(coord.listener >= 0){
+        close(coord.listener);
+
+        if(!strncmp(coord.address, "unix:", 5)) unlink(coord.address + 5);
+    }
+
+    for(int i = 0; i < coord.n_local; ++i){
+        waitpid(coord.local[i], NULL, 0);
+    }
+
+    coord.listener = -1;
+    coord.n_local = 0;
+    coord.address[0] = '\0';
+}
+
+/// @brief Listen on `address` for workers, and start `local` worker processes
+/// @param address
+/// @param local
+/// @return
+int coordinate(const char* address, int local){
+    if(strcmp(address, coord.address) || (coord.listener < 0)){
+        free_coordinator();
+
+        coord.listener = open_socket(address, 1);
+
+        if(coord.listener < 0){
+            printf("[ERROR] could not listen on %s\n", address);
+            return -1;
+        }
+
+        fcntl(coord.listener, F_SETFL, fcntl(coord.listener, F_GETFL) | O_NONBLOCK);
+        snprintf(coord.address, sizeof(coord.address), "%s", address);
+    }
+
+    spawn_workers(local);
+
+    return 0;
+}
+
+/// @brief State of a distributed render
+typedef struct {
+    int size;
+    int n_tiles;
+    int* done;
+    int* holders; // workers rendering each band
+    double* handed_at;
+    int n_done;
+    Pixel (*canvas)[IMAGE_SIZE];
+} Dist_render;
+
+/// @brief Give `w` bands to render up to its pipeline, new ones first, then copies of the band that has been out the longest
+void hand_out(Dist_render* d, Dist_worker* w, const Text* job){
+    if(w->job != coord.job){
+        text_append(&w->c.out, job->data, job->used);
+        w->job = coord.job;
+    }
+
+    for(int slot = 0; slot < DIST_PIPELINE; ++slot){
+        int busy = 0;
+
+        for(int s = 0; s < DIST_PIPELINE; ++s) busy += w->tiles[s] >= 0;
+
+        if(w->tiles[slot] >= 0) continue;
+
+        int best = -1;
+
+        for(int t = 0; t < d->n_tiles; ++t){
+            int mine = 0;
+
+            for(int s = 0; s < DIST_PIPELINE; ++s) mine |= w->tiles[s] == t;
+
+            if(d->done[t] || mine) continue;
+
+            if((best < 0) || (d->holders[t] < d->holders[best]) || ((d->holders[t] == d->holders[best]) && (d->handed_at[t] < d->handed_at[best]))){
+                best = t;
+            }
+        }
+
+        // only copy bands once every band is out and the worker has nothing else to do, and never ask a worker to render a band twice
+        if((best < 0) || ((d->holders[best] > 0) && busy)){
+            return;
+        }
+
+        int first = best * DIST_TILE_ROWS;
+        int rows = (first + DIST_TILE_ROWS <= d->size) ? DIST_TILE_ROWS : d->size - first;
+
+        put_u32(&w->c.out, 4 * sizeof(uint32_t));
+        put_u32(&w->c.out, MSG_TILE);
+        put_u32(&w->c.out, coord.job);
+        put_u32(&w->c.out, first);
+        put_u32(&w->c.out, rows);
+
+        if(!d->holders[best]) d->handed_at[best] = now_ns();
+
+        d->holders[best]++;
+        w->tiles[slot] = best;
+    }
+}
+
+/// @brief Hand a worker's bands back
+void drop_tiles(Dist_render* d, Dist_worker* w){
+    for(int s = 0; s < DIST_PIPELINE; ++s){
+        if(w->tiles[s] >= 0) d->holders[w->tiles[s]]--;
+        w->tiles[s] = -1;
+    }
+}
+
+/// @brief Scale a band sent back by a worker into the image
+/// @param d
+/// @param w NULL for bands rendered by the coordinator
+/// @param first
+/// @param rows
+/// @param rgb
+void take_rows(Dist_render* d, Dist_worker* w, int first, int rows, const char* rgb){
+    int scale = IMAGE_SIZE / d->size;
+    int t = first / DIST_TILE_ROWS;
+
+    for(int s = 0; (w != NULL) && (s < DIST_PIPELINE); ++s){
+        if(w->tiles[s] == t){
+            w->tiles[s] = -1;
+            d->holders[t]--;
+        }
+    }
+
+    if(d->done[t]){
+        return;
+    }
+
+    for(int y = 0; y < rows; ++y){
+        for(int x = 0; x < d->size; ++x){
+            const char* p = rgb + ((size_t)y * d->size + x) * 3;
+            Pixel pixel = {.r = p[0], .g = p[1], .b = p[2], .a = 255};
+
+            for(int j = 0; j < scale; ++j){
+                for(int i = 0; i < scale; ++i){
+                    d->canvas[(first + y) * scale + j][x * scale + i] = pixel;
+                }
+            }
+        }
+    }
+
+    d->done[t] = 1;
+    d->n_done++;
+
+    if(w != NULL) w->rendered++;
+}
+
+/// @brief Read what a worker sent and take every band in it
+/// @return -1 if the worker is gone or sent something it shouldn't
+int read_worker(Dist_render* d, Dist_worker* w){
+    Client* c = &w->c;
+
+    while(1){
+        text_reserve(&c->in, SERVER_READ_SIZE);
+        ssize_t n = recv(c->fd, c->in.data + c->in.used, SERVER_READ_SIZE, 0);
+
+        if(n == 0){
+            return -1;
+        } else if(n < 0){
+            if((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+            return -1;
+        }
+
+        c->in.used += n;
+    }
+
+    size_t at = 0;
+
+    while(c->in.used - at >= sizeof(uint32_t)){
+        uint32_t length = get_u32(c->in.data + at);
+
+        if(c->in.used - at - sizeof(uint32_t) < length){
+            break;
+        }
+
+        const char* frame = c->in.data + at + sizeof(uint32_t);
+
+        if((length < 4 * sizeof(uint32_t)) || (get_u32(frame) != MSG_ROWS)){
+            return -1;
+        }
+
+        int job = get_u32(frame + 4), first = get_u32(frame + 8), rows = get_u32(frame + 12);
+
+        // bands of earlier renders that were copied to it
+        if(job == coord.job){
+            if((first % DIST_TILE_ROWS) || (rows < 1) || (first + rows > d->size) || (length != 4 * sizeof(uint32_t) + (size_t)rows * d->size * 3)){
+                return -1;
+            }
+
+            take_rows(d, w, first, rows, frame + 4 * sizeof(uint32_t));
+        }
+
+        at += sizeof(uint32_t) + length;
+    }
+
+    memmove(c->in.data, c->in.data + at, c->in.used - at);
+    c->in.used -= at;
+
+    return 0;
+}
+
+/// @brief Render the AST held in `ast` on a `size` grid with the workers of the coordinator, and write it to a png at `path`. Bands no worker
+/// @brief is left to render are rendered locally
+/// @param size
+/// @param path
+/// @return
+int render_distributed(int size, const char* path){
+    static Pixel canvas[IMAGE_SIZE][IMAGE_SIZE];
+    Dist_render d = {.size = size, .n_tiles = (size + DIST_TILE_ROWS - 1) / DIST_TILE_ROWS, .canvas = canvas};
+    Text job = {0};
+    double start = now_ns(), alone_since = start;
+    int local_bands = 0;
+
+    d.done = (int*)calloc(d.n_tiles, sizeof(int));
+    d.holders = (int*)calloc(d.n_tiles, sizeof(int));
+    d.handed_at = (double*)calloc(d.n_tiles, sizeof(double));
+    assert((d.done != NULL) && (d.holders != NULL) && (d.handed_at != NULL));
+
+    // the AST is only packed once, whatever the number of workers
+    coord.job++;
+    put_u32(&job, 0);
+    put_u32(&job, MSG_JOB);
+    put_u32(&job, coord.job);
+    put_u32(&job, size);
+    pack_ast(&job);
+
+    uint32_t length = htonl(job.used - sizeof(uint32_t));
+    memcpy(job.data, &length, sizeof(length));
+
+    // bands of the last render that are still queued are rendered and thrown away
+    for(int i = 0; i < DIST_MAX_WORKERS; ++i){
+        for(int s = 0; (coord.workers[i] != NULL) && (s < DIST_PIPELINE); ++s) coord.workers[i]->tiles[s] = -1;
+    }
+
+    while(d.n_done < d.n_tiles){
+        struct pollfd fds[DIST_MAX_WORKERS + 1] = {{.fd = coord.listener, .events = POLLIN}};
+        Dist_worker* polled[DIST_MAX_WORKERS + 1] = {NULL};
+        int n = 1, alive = 0;
+
+        for(int i = 0; i < DIST_MAX_WORKERS; ++i){
+            Dist_worker* w = coord.workers[i];
+
+            if(w == NULL) continue;
+
+            hand_out(&d, w, &job);
+
+            if(flush_client(&w->c) != 0){
+                drop_tiles(&d, w);
+                close_worker(w);
+                continue;
+            }
+
+            fds[n] = (struct pollfd){.fd = w->c.fd, .events = POLLIN | ((w->c.out.used != 0) ? POLLOUT : 0)};
+            polled[n++] = w;
+            alive++;
+        }
+
+        if(alive){
+            alone_since = now_ns();
+
+        } else if((now_ns() - alone_since) / 1e6 > DIST_CONNECT_MS){
+            // nobody to hand the rest to
+            static char rgb[DIST_TILE_ROWS * IMAGE_SIZE * 3];
+            Render r;
+
+            start_rows(&r, size);
+
+            for(int t = 0; t < d.n_tiles; ++t){
+                if(d.done[t]) continue;
+
+                int first = t * DIST_TILE_ROWS, rows = (first + DIST_TILE_ROWS <= size) ? DIST_TILE_ROWS : size - first;
+
+                render_rows(&r, first, first + rows - 1);
+
+                for(int y = 0; y < rows; ++y){
+                    for(int x = 0; x < size; ++x) memcpy(rgb + ((size_t)y * size + x) * 3, r.canvas[first + y] + x, 3);
+                }
+
+                take_rows(&d, NULL, first, rows, rgb);
+                local_bands++;
+            }
+
+            stop_rows(&r);
+            break;
+        }
+
+        if(poll(fds, n, DIST_POLL_MS) < 0){
+            if(errno == EINTR) continue;
+
+            printf("[ERROR] poll failed\n");
+            break;
+        }
+
+        if(fds[0].revents & POLLIN){
+            accept_workers();
+        }
+
+        for(int i = 1; i < n; ++i){
+            if((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && (read_worker(&d, polled[i]) != 0)){
+                printf("A worker left, handing its bands to the others\n");
+                drop_tiles(&d, polled[i]);
+                close_worker(polled[i]);
+            }
+        }
+    }
+
+    double ms = (now_ns() - start) / 1e6;
+    int workers = 0;
+
+    for(int i = 0; i < DIST_MAX_WORKERS; ++i){
+        Dist_worker* w = coord.workers[i];
+
+        if(w == NULL) continue;
+
+        printf("worker %d rendered %d bands\n", workers++, w->rendered);
+        w->rendered = 0;
+    }
+
+    if(local_bands){
+        printf("%d bands rendered locally, no worker was left\n", local_bands);
+    }
+
+    printf("Rendered %d bands on %d workers in %.1f ms\n", d.n_tiles, workers, ms);
+
+    free(job.data);
+    free(d.done);
+    free(d.holders);
+    free(d.handed_at);
+
+    if(!stbi_write_png(path, IMAGE_SIZE, IMAGE_SIZE, 4, *canvas, sizeof(Pixel) * IMAGE_SIZE)){
+        printf("[ERROR] could not write image\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,388 @@
+#ifndef EXPLORE_H
+#define EXPLORE_H
+
+#include <stdio.h>
+#include "grammar.h"
+#include "simplify.h"
+#include "peephole.h"
+#include "check.h"
+#include "cost.h"
+#include "render.h"
+#include "pool.h"
+
+/*
+    Genetic exploration. A population of ASTs is rendered at low resolution onto one contact sheet, explore.png, and the
+    user picks parents for the next generation. Children are a subtree of one parent swapped for a subtree of the other,
+    then mutated: constants are jittered, and operators and leaves are swapped for others of the same arity drawn from the
+    grammar's branches.
+
+    Genomes are kept as generated, and only simplified and fused into a copy for rendering. Both live in node arenas that
+    are reused from generation to generation, and candidates are rendered in parallel on the pool from the compiled arena.
+*/
+
+#define POPULATION 8
+#define EXPLORE_COLUMNS 4
+#define EXPLORE_SIZE 128 // each candidate is sampled on an EXPLORE_SIZE x EXPLORE_SIZE grid
+#define EXPLORE_MAX_NODES 50000 // children bigger than this don't get the crossover
+#define MUTATION_RATE 0.05 // chance of each node being mutated
+#define JITTER 0.2 // constants move by up to this much
+#define NO_CROSSOVER UINT32_MAX
+
+typedef struct {
+    Node* nodes;
+    size_t used;
+    size_t capacity;
+} Arena;
+
+typedef struct {
+    uint32_t offset; // of its first node in the arena
+    uint32_t count;
+    uint32_t root; // index in the arena
+} Genome;
+
+typedef struct {
+    const Node* nodes; // compiled arena
+    uint32_t root;
+    int slot; // position on the contact sheet
+    Pixel (*sheet)[EXPLORE_COLUMNS * EXPLORE_SIZE];
+} Candidate_job;
+
+/// @brief Add `delta` to every child index of `count` nodes. Indices wrap, so a negative delta can be passed as its unsigned value
+void rebase_nodes(Node* nodes, size_t count, uint32_t delta){
+    for(size_t i = 0; i < count; ++i){
+        Node* n = nodes + i;
+        Node_kind nk = node_kind(n);
+
+        if(nk & NK_UNOP){
+            n->as.unop += delta;
+        } else if (nk & NK_BINOP){
+            n->as.binop.lhs += delta;
+            n->as.binop.rhs += delta;
+        } else if (nk & (NK_TRIPLE | NK_TERNOP)){
+            n->as.triple.first += delta;
+            n->as.triple.second += delta;
+            n->as.triple.third += delta;
+        }
+    }
+}
+
+/// @brief Append the nodes of `ast`, whose root is last, to `arena`
+/// @param arena
+/// @return genome pointing at the appended nodes
+Genome arena_push_ast(Arena* arena){
+    if(arena->used + ast.used > arena->capacity){
+        arena->capacity = 2 * (arena->used + ast.used);
+        arena->nodes = (Node*)realloc(arena->nodes, sizeof(Node) * arena->capacity);
+        assert(arena->nodes != NULL);
+    }
+
+    Genome genome = {.offset = arena->used, .count = ast.used, .root = arena->used + ast.used - 1};
+
+    memcpy(arena->nodes + arena->used, ast.array, sizeof(Node) * ast.used);
+    rebase_nodes(arena->nodes + arena->used, ast.used, genome.offset);
+    arena->used += ast.used;
+
+    return genome;
+}
+
+/// @brief Replace `ast` with a copy of `genome` from `arena`
+void load_genome(const Arena* arena, Genome genome){
+    reset_ast();
+
+    for(uint32_t i = 0; i < genome.count; ++i){
+        Node n = arena->nodes[genome.offset + i];
+
+        rebase_nodes(&n, 1, -genome.offset);
+        add_node_to_ast(n, __LINE__, __FILE__);
+    }
+}
+
+/// @brief Pick a branch of the grammar weighted by its probability, among those `accept` returns true for
+/// @param accept
+/// @param nk passed on to `accept`
+/// @return NULL if no branch is accepted
+Branch* random_branch(int (*accept)(Branch*, Node_kind), Node_kind nk){
+    float total = 0;
+    Branch* picked = NULL;
+
+    for(size_t r = 0; r < g.used; ++r){
+        for(size_t i = 0; i < g.rule[r].used; ++i){
+            Branch* b = g.rule[r].branch + i;
+
+            if(!accept(b, nk) || (b->prob <= 0)) continue;
+
+            // reservoir sampling, weighted by branch probability
+            total += b->prob;
+
+            if(randrange(0, 1) * total <= b->prob){
+                picked = b;
+            }
+        }
+    }
+
+    return picked;
+}
+
+/// @brief Branches that build a node with the same arity as `nk`
+int same_arity(Branch* b, Node_kind nk){
+    if(nk & NK_UNOP) return (b->kind == BK_SINGLE_RULE_NODE) && (b->node_kind & NK_UNOP);
+    if(nk & NK_BINOP) return (b->kind == BK_DOUBLE_RULE) && (b->node_kind & NK_BINOP);
+
+    return (b->kind == BK_NO_RULE) && (b->node_kind & (NK_X | NK_Y | NK_NUMBER));
+}
+
+/// @brief Copy the subtree at `index` of `from` into `ast` as is
+size_t copy_subtree(const Node* from, uint32_t index){
+    Node n = from[index];
+    Node_kind nk = node_kind(&n);
+
+    if(nk & NK_UNOP){
+        n.as.unop = copy_subtree(from, n.as.unop);
+    } else if (nk & NK_BINOP){
+        n.as.binop.lhs = copy_subtree(from, n.as.binop.lhs);
+        n.as.binop.rhs = copy_subtree(from, n.as.binop.rhs);
+    } else if (nk & (NK_TRIPLE | NK_TERNOP)){
+        n.as.triple.first = copy_subtree(from, n.as.triple.first);
+        n.as.triple.second = copy_subtree(from, n.as.triple.second);
+        n.as.triple.third = copy_subtree(from, n.as.triple.third);
+    }
+
+    return add_node_to_ast(n, __LINE__, __FILE__);
+}
+
+/// @brief Copy the subtree at `index` of `from` into `ast`, with the subtree at `swap_out` replaced by the one at `swap_in`, and mutated
+/// @param from
+/// @param index
+/// @param swap_out `NO_CROSSOVER` to only mutate
+/// @param swap_in
+/// @return
+size_t breed_node(const Node* from, uint32_t index, uint32_t swap_out, uint32_t swap_in){
+    if(index == swap_out){
+        return copy_subtree(from, swap_in);
+    }
+
+    Node n = from[index];
+    Node_kind nk = node_kind(&n);
+    int mutate = (nk & (NK_UNOP | NK_BINOP | NK_X | NK_Y | NK_NUMBER)) && (randrange(0, 1) < MUTATION_RATE);
+
+    if(mutate && (nk == NK_NUMBER) && (randrange(0, 1) < 0.5)){
+        n.as.number = clamp(n.as.number + randrange(-JITTER, JITTER), -1, 1);
+
+    } else if (mutate){
+        Branch* b = random_branch(same_arity, nk);
+
+        if(b != NULL){
+            n.op = node_kind_index(b->node_kind);
+
+            if((b->node_kind == NK_NUMBER) && (nk != NK_NUMBER)){
+                n.as.number = randrange(-1, 1);
+            }
+        }
+    }
+
+    if(nk & NK_UNOP){
+        n.as.unop = breed_node(from, n.as.unop, swap_out, swap_in);
+    } else if (nk & NK_BINOP){
+        n.as.binop.lhs = breed_node(from, n.as.binop.lhs, swap_out, swap_in);
+        n.as.binop.rhs = breed_node(from, n.as.binop.rhs, swap_out, swap_in);
+    } else if (nk & NK_TRIPLE){
+        n.as.triple.first = breed_node(from, n.as.triple.first, swap_out, swap_in);
+        n.as.triple.second = breed_node(from, n.as.triple.second, swap_out, swap_in);
+        n.as.triple.third = breed_node(from, n.as.triple.third, swap_out, swap_in);
+    }
+
+    return add_node_to_ast(n, __LINE__, __FILE__);
+}
+
+/// @brief Index of a random node of `genome` that evaluates to a number, a place where subtrees can be swapped
+uint32_t random_channel_node(const Arena* arena, Genome genome){
+    for(int tries = 0; tries < 100; ++tries){
+        uint32_t index = genome.offset + (uint32_t)(randrange(0, 1) * (genome.count - 1));
+
+        if(!(node_kind(arena->nodes + index) & NK_TRIPLE)){
+            return index;
+        }
+    }
+
+    return NO_CROSSOVER;
+}
+
+/// @brief Build a child of `a` and `b` into `ast`
+void breed(const Arena* arena, Genome a, Genome b){
+    uint32_t swap_out = random_channel_node(arena, a);
+    uint32_t swap_in = random_channel_node(arena, b);
+
+    if(swap_in == NO_CROSSOVER){
+        swap_out = NO_CROSSOVER;
+    }
+
+    reset_ast();
+    breed_node(arena->nodes, a.root, swap_out, swap_in);
+
+    if(ast.used > EXPLORE_MAX_NODES){
+        reset_ast();
+        breed_node(arena->nodes, a.root, NO_CROSSOVER, NO_CROSSOVER);
+    }
+}
+
+/// @brief Sample one compiled candidate into its slot of the contact sheet. Runs on a pool thread
+/// @param arg `Candidate_job*`
+void candidate_job(void* arg){
+    Candidate_job* job = (Candidate_job*)arg;
+    int left = (job->slot % EXPLORE_COLUMNS) * EXPLORE_SIZE;
+    int top = (job->slot / EXPLORE_COLUMNS) * EXPLORE_SIZE;
+
+    for(int j = 0; j < EXPLORE_SIZE; ++j){
+        for(int i = 0; i < EXPLORE_SIZE; ++i){
+            float rgb[3];
+
+            eval_rgb(job->nodes, job->root, ((float)i / EXPLORE_SIZE) * 2.0 - 1.0, ((float)j / EXPLORE_SIZE) * 2.0 - 1.0, 0, rgb);
+
+            job->sheet[top + j][left + i] = (Pixel){quantize(rgb[0]), quantize(rgb[1]), quantize(rgb[2]), 255};
+        }
+    }
+}
+
+/// @brief Simplify, fuse and check a copy of `genome`, then append it to `compiled`
+/// @return 0 if the genome can be evaluated
+int compile_genome(const Arena* genomes, Genome genome, Arena* compiled, Genome* out){
+    load_genome(genomes, genome);
+
+    simplify_ast();
+    peephole_ast();
+
+    if(check_ast(ast.ast_root) != 0){
+        return -1;
+    }
+
+    *out = arena_push_ast(compiled);
+
+    return 0;
+}
+
+/// @brief Render every genome of the population onto explore.png, in parallel
+void render_population(const Arena* genomes, const Genome population[POPULATION], Arena* compiled){
+    static Pixel sheet[POPULATION / EXPLORE_COLUMNS * EXPLORE_SIZE][EXPLORE_COLUMNS * EXPLORE_SIZE];
+    Candidate_job jobs[POPULATION];
+    Genome ready[POPULATION];
+    int valid[POPULATION];
+
+    double start = now_ns();
+
+    memset(sheet, 0, sizeof(sheet));
+    compiled->used = 0;
+
+    // compile everything first, the compiled arena may move while it grows
+    for(int i = 0; i < POPULATION; ++i){
+        valid[i] = compile_genome(genomes, population[i], compiled, ready + i) == 0;
+    }
+
+    for(int i = 0; i < POPULATION; ++i){
+        if(!valid[i]) continue;
+
+        jobs[i] = (Candidate_job){.nodes = compiled->nodes, .root = ready[i].root, .slot = i, .sheet = sheet};
+        pool_submit(candidate_job, jobs + i);
+    }
+
+    pool_wait();
+
+    if(!stbi_write_png("explore.png", EXPLORE_COLUMNS * EXPLORE_SIZE, POPULATION / EXPLORE_COLUMNS * EXPLORE_SIZE, 4, *sheet, sizeof(sheet[0]))){
+        printf("[ERROR] could not write explore.png\n");
+        return;
+    }
+
+    printf("Rendered %d candidates to explore.png in %.0f ms, numbered left to right, top to bottom from 0\n", POPULATION, (now_ns() - start) / 1e6);
+}
+
+/// @brief Interactive exploration, starting from the ASTs of seeds `seed` onwards at `depth`. Leaves the picked AST in `ast`
+/// @param seed
+/// @param depth
+/// @return 0 if an AST was picked
+int explore(U64 seed, int depth){
+    Arena genomes[2] = {0}; // this generation and the next
+    Arena compiled = {0};
+    Genome population[POPULATION];
+    char command[INPUT_SIZE];
+    int current = 0;
+    int picked = -1;
+    int generation = 0;
+    int changed = 1;
+
+    init_pool();
+
+    for(int i = 0; i < POPULATION; ++i){
+        reset_ast();
+        srand(seed + i);
+        generate_ast(g.entry_point, depth);
+
+        population[i] = arena_push_ast(genomes);
+    }
+
+    srand(seed);
+
+    while(picked < 0){
+
+        if(changed){
+            printf("Generation %d\n", generation);
+            render_population(genomes + current, population, &compiled);
+
+            printf("Pick parents with `breed i j` (or just `breed i` to mutate one), keep one with `pick i`, or leave with `back`\n");
+            changed = 0;
+        }
+
+        if(get_input(command) || !strncmp(command, "back", 4)){
+            break;
+        }
+
+        int a = -1, b = -1;
+
+        if(!strncmp(command, "pick", 4) && (sscanf(command + 4, "%d", &a) == 1) && (a >= 0) && (a < POPULATION)){
+            picked = a;
+            break;
+        }
+
+        int parents = !strncmp(command, "breed", 5) ? sscanf(command + 5, "%d %d", &a, &b) : 0;
+
+        if((parents < 1) || (a < 0) || (a >= POPULATION) || ((parents == 2) && ((b < 0) || (b >= POPULATION)))){
+            printf("[ERROR] expected `breed i j`, `pick i` or `back`, with candidates between 0 and %d\n", POPULATION - 1);
+            continue;
+        }
+
+        if(parents == 1){
+            b = a;
+        }
+
+        Arena* next = genomes + !current;
+        Genome children[POPULATION];
+        next->used = 0;
+
+        // the parents survive, the rest are their children
+        for(int i = 0; i < POPULATION; ++i){
+            if((i == 0) || ((i == 1) && (b != a))){
+                load_genome(genomes + current, population[(i == 0) ? a : b]);
+            } else {
+                int swap = randrange(0, 1) < 0.5;
+                breed(genomes + current, population[swap ? b : a], population[swap ? a : b]);
+            }
+
+            children[i] = arena_push_ast(next);
+        }
+
+        memcpy(population, children, sizeof(children));
+        current = !current;
+        generation++;
+        changed = 1;
+    }
+
+    if(picked >= 0){
+        load_genome(genomes + current, population[picked]);
+    }
+
+    free(genomes[0].nodes);
+    free(genomes[1].nodes);
+    free(compiled.nodes);
+
+    return (picked >= 0) ? 0 : -1;
+}
+
+#endif
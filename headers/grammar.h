@@ -366,6 +366,9 @@ void print_branch(Branch* b){
             case NK_NUMBER:
                 printf("random number [-1 1]"); break;
 
+            case NK_FMA:
+            case NK_AFFINE_X:
+            case NK_AFFINE_Y:
             default:
                 printf("Node added to grammar unknown!\n");
                 exit(-1);
@@ -424,12 +427,20 @@ Branch* get_current_branch(Rule* rule, int depth){
     }
 }
 
+size_t node_budget = 0; // `generate_ast` only adds terminals once the AST holds this many nodes, 0 for no limit
+int over_budget = 0; // set once the budget is hit, the AST generated is then cut short
+
 /// @brief Given an entry point, generate AST based on grammar
 /// @param rule 
 /// @param depth 
 /// @return 
 size_t generate_ast(Rule* rule, int depth){
 
+    if(node_budget && (ast.used >= node_budget)){
+        over_budget = 1;
+        depth = -1;
+    }
+
     Branch* b = get_current_branch(rule, depth);
 
     switch (b->kind){
@@ -0,0 +1,110 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <string.h>
+#include "ast.h"
+
+/*
+    Canonical structural hash of ASTs. A node's hash only depends on its kind, its constants and the hashes of its children,
+    never on where nodes sit in the array, so the same function built in a different order, parsed, generated or loaded,
+    hashes the same. add and mult hash their operands as an unordered pair, and so do the multiplied operands of fma,
+    since swapping them doesn't change a float result. Hashes are of the AST as it is rendered, after simplification and
+    fusion.
+*/
+
+/// @brief splitmix64 finalizer
+U64 mix_hash(U64 h){
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+
+    return h;
+}
+
+U64 combine_hash(U64 h, U64 v){
+    return mix_hash(h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
+U64 float_hash(float f){
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    return mix_hash(bits + 1);
+}
+
+/// @brief Hash of `n`, given the hashes of every node before it
+/// @param hashes
+/// @param n
+/// @return
+U64 node_hash(const U64* hashes, const Node* n){
+    Node_kind nk = node_kind(n);
+    U64 h = mix_hash(n->op + 0x51);
+
+    switch(nk){
+        case NK_X:
+        case NK_Y:
+            return h;
+
+        case NK_NUMBER:
+            return combine_hash(h, float_hash(n->as.number));
+
+        case NK_AFFINE_X:
+        case NK_AFFINE_Y:
+            return combine_hash(combine_hash(h, float_hash(n->as.affine.scale)), float_hash(n->as.affine.offset));
+
+        case NK_SIN:
+        case NK_COS:
+        case NK_EXP:
+            return combine_hash(h, hashes[n->as.unop]);
+
+        case NK_ADD:
+        case NK_MULT: {
+            U64 a = hashes[n->as.binop.lhs], b = hashes[n->as.binop.rhs];
+
+            return combine_hash(combine_hash(h, (a < b) ? a : b), (a < b) ? b : a);
+        }
+
+        case NK_MOD:
+        case NK_DIV:
+        case NK_GEQ:
+            return combine_hash(combine_hash(h, hashes[n->as.binop.lhs]), hashes[n->as.binop.rhs]);
+
+        case NK_FMA: {
+            U64 a = hashes[n->as.triple.first], b = hashes[n->as.triple.second];
+
+            return combine_hash(combine_hash(combine_hash(h, (a < b) ? a : b), (a < b) ? b : a), hashes[n->as.triple.third]);
+        }
+
+        case NK_E:
+        case NK_IF_THEN_ELSE:
+        default:
+            return combine_hash(combine_hash(combine_hash(h, hashes[n->as.triple.first]), hashes[n->as.triple.second]), hashes[n->as.triple.third]);
+    }
+}
+
+/// @brief Hash every node of `nodes`, whose children must come before them, as they do in `ast` and in packed ASTs
+/// @param nodes
+/// @param count
+/// @param hashes filled with the hash of the subtree rooted at each node
+void hash_nodes(const Node* nodes, size_t count, U64* hashes){
+    for(size_t i = 0; i < count; ++i){
+        hashes[i] = node_hash(hashes, nodes + i);
+    }
+}
+
+/// @brief Hash of the AST held in `ast`, which must have been built, see `reallocate_ast_after_build`
+U64 ast_hash(){
+    U64* hashes = (U64*)malloc(sizeof(U64) * ast.size);
+    assert(hashes != NULL);
+
+    hash_nodes(ast.array, ast.size, hashes);
+    U64 h = hashes[ast.size - 1];
+
+    free(hashes);
+
+    return h;
+}
+
+#endif
@@ -10,12 +10,13 @@
 void expect_number(Node* n){
 
     if(n == NULL){
-        printf("[FILE: %s] Node added at line %d failed to evaluate!\n", n->file, n->line);
+        printf("Node failed to evaluate!\n");
         exit(-1);
     }
     
-    if(n->nk != NK_NUMBER){
-        printf("[FILE: %s] Node added at line %d cannot evaluate to a number!\n", n->file, n->line);
+    if(node_kind(n) != NK_NUMBER){
+        print_node_loc(n - ast.array);
+        printf("cannot evaluate to a number!\n");
         exit(-1);
     }
 }
@@ -28,12 +29,12 @@ void expect_number(Node* n){
 size_t eval_ast(size_t index, float x, float y){
     Node* n = ast.array + index;
 
-    switch(n->nk){
+    switch(node_kind(n)){
         case NK_X: 
-            return node_number_loc(x, n->line, n->file);
+            return node_number_loc(x, node_line(index), node_file(index));
             
         case NK_Y:
-            return node_number_loc(y, n->line, n->file);
+            return node_number_loc(y, node_line(index), node_file(index));
 
         case NK_ADD:{
             Node* lhs_eval = ast.array + eval_ast(n->as.binop.lhs, x, y);
@@ -42,7 +43,7 @@ size_t eval_ast(size_t index, float x, float y){
             expect_number(lhs_eval);
             expect_number(rhs_eval);
 
-            return node_number_loc(lhs_eval->as.number + rhs_eval->as.number, n->line, n->file);
+            return node_number_loc(lhs_eval->as.number + rhs_eval->as.number, node_line(index), node_file(index));
         }
 
         case NK_MULT: {
@@ -52,9 +53,28 @@ size_t eval_ast(size_t index, float x, float y){
             expect_number(lhs_eval);
             expect_number(rhs_eval);
 
-            return node_number_loc(lhs_eval->as.number * rhs_eval->as.number, n->line, n->file);
+            return node_number_loc(lhs_eval->as.number * rhs_eval->as.number, node_line(index), node_file(index));
         }
 
+        case NK_FMA: {
+            Node* a_eval = ast.array + eval_ast(n->as.triple.first, x, y);
+            Node* b_eval = ast.array + eval_ast(n->as.triple.second, x, y);
+            Node* c_eval = ast.array + eval_ast(n->as.triple.third, x, y);
+
+            expect_number(a_eval);
+            expect_number(b_eval);
+            expect_number(c_eval);
+
+            // one rounding instead of two
+            return node_number_loc(fmaf(a_eval->as.number, b_eval->as.number, c_eval->as.number), node_line(index), node_file(index));
+        }
+
+        case NK_AFFINE_X:
+            return node_number_loc(fmaf(n->as.affine.scale, x, n->as.affine.offset), node_line(index), node_file(index));
+
+        case NK_AFFINE_Y:
+            return node_number_loc(fmaf(n->as.affine.scale, y, n->as.affine.offset), node_line(index), node_file(index));
+
         case NK_E: {
 
             size_t first_eval_index = eval_ast(n->as.triple.first, x, y);
@@ -70,8 +90,8 @@ size_t eval_ast(size_t index, float x, float y){
                 first_eval_index,
                 second_eval_index,
                 third_eval_index,
-                n->line,
-                n->file
+                node_line(index),
+                node_file(index)
             );
         }
 
@@ -82,7 +102,7 @@ size_t eval_ast(size_t index, float x, float y){
             expect_number(lhs_eval);
             expect_number(rhs_eval);
 
-            return node_number_loc(lhs_eval->as.number >= rhs_eval->as.number, n->line, n->file);
+            return node_number_loc(lhs_eval->as.number >= rhs_eval->as.number, node_line(index), node_file(index));
         }
 
         case NK_MOD: {
@@ -96,7 +116,7 @@ size_t eval_ast(size_t index, float x, float y){
                 rhs_eval->as.number = 1.0;
             }
 
-            return node_number_loc(fmod(lhs_eval->as.number, rhs_eval->as.number), n->line, n->file);
+            return node_number_loc(fmod(lhs_eval->as.number, rhs_eval->as.number), node_line(index), node_file(index));
         }
 
         case NK_DIV: {
@@ -111,7 +131,7 @@ size_t eval_ast(size_t index, float x, float y){
                 rhs_eval->as.number = 1.0;
             }
 
-            return node_number_loc(lhs_eval->as.number / rhs_eval->as.number, n->line, n->file);
+            return node_number_loc(lhs_eval->as.number / rhs_eval->as.number, node_line(index), node_file(index));
         }
         
         case NK_SIN: {
@@ -120,7 +140,7 @@ size_t eval_ast(size_t index, float x, float y){
 
             expect_number(eval);
             
-            return node_number_loc(sin(eval->as.number), n->line, n->file);
+            return node_number_loc(sin(eval->as.number), node_line(index), node_file(index));
         }
 
         case NK_COS: {
@@ -129,7 +149,7 @@ size_t eval_ast(size_t index, float x, float y){
 
             expect_number(eval);
             
-            return node_number_loc(cos(eval->as.number), n->line, n->file);
+            return node_number_loc(cos(eval->as.number), node_line(index), node_file(index));
         }        
 
         case NK_EXP: {
@@ -137,7 +157,7 @@ size_t eval_ast(size_t index, float x, float y){
 
             expect_number(eval);
             
-            return node_number_loc(exp(eval->as.number), n->line, n->file);
+            return node_number_loc(exp(eval->as.number), node_line(index), node_file(index));
         }
 
         case NK_IF_THEN_ELSE: {
@@ -161,15 +181,112 @@ size_t eval_ast(size_t index, float x, float y){
             if(n == NULL){
                 printf("Node is NULL!\n");
             } else {
-                printf("[FILE %s] Node added at line %d ", n->file, n->line);
+                print_node_loc(index);
                 printf("should not be able to reach this in eval ast!\n");
-                printf("\nkind %d\n", n->nk);
+                printf("\nkind %d\n", node_kind(n));
             }
             
             exit(-1);
     }
 }
 
+#define FAST_MATH_LIMIT 1e6 // past this, range reduction in `fast_sin` loses too much precision
+
+/// @brief sin of `v` to within 1e-4, about a fiftieth of an 8 bit level. Reduced to [-pi/2, pi/2], then a degree 9 Taylor polynomial
+float fast_sin(float v){
+    if(!(fabsf(v) < FAST_MATH_LIMIT)){
+        return sinf(v);
+    }
+
+    float k = rintf(v * (float)M_1_PI);
+    float r = fmaf(-k, 3.14159274f, v);
+    r = fmaf(k, 8.74227766e-8f, r); // rest of pi, which isn't exact in float
+
+    float r2 = r * r;
+    float s = r * (1.0f + r2 * (-1.0f / 6 + r2 * (1.0f / 120 + r2 * (-1.0f / 5040 + r2 * (1.0f / 362880)))));
+
+    return ((long)k & 1) ? -s : s;
+}
+
+float fast_cos(float v){
+    return fast_sin(v + (float)M_PI_2);
+}
+
+/// @brief Body of an evaluator that returns numbers, where `CHILD(i)` evaluates child node `i`. `eval_number` and `eval_plane_node` are both
+/// @brief expanded from it, so they can't disagree on what an operator means. Expects `nodes`, `index`, `x`, `y` and `fast` in scope, `fast`
+/// @brief evaluating sin and cos with `fast_sin` and exp in float
+#define EVAL_NUMBER_NODE(CHILD) \
+    const Node* n = nodes + index; \
+    \
+    switch(node_kind(n)){ \
+        case NK_X: return x; \
+        case NK_Y: return y; \
+        case NK_NUMBER: return n->as.number; \
+        \
+        case NK_SIN: { float v = CHILD(n->as.unop); return fast ? fast_sin(v) : sin(v); } \
+        case NK_COS: { float v = CHILD(n->as.unop); return fast ? fast_cos(v) : cos(v); } \
+        case NK_EXP: { float v = CHILD(n->as.unop); return fast ? expf(v) : exp(v); } \
+        \
+        case NK_ADD: return CHILD(n->as.binop.lhs) + CHILD(n->as.binop.rhs); \
+        case NK_MULT: return CHILD(n->as.binop.lhs) * CHILD(n->as.binop.rhs); \
+        case NK_GEQ: return CHILD(n->as.binop.lhs) >= CHILD(n->as.binop.rhs); \
+        \
+        case NK_MOD: { \
+            float lhs = CHILD(n->as.binop.lhs); \
+            float rhs = CHILD(n->as.binop.rhs); \
+            return fmod(lhs, (rhs == 0.0) ? 1.0 : rhs); \
+        } \
+        \
+        case NK_DIV: { \
+            float lhs = CHILD(n->as.binop.lhs); \
+            float rhs = CHILD(n->as.binop.rhs); \
+            return lhs / ((rhs == 0.0) ? 1.0 : rhs); \
+        } \
+        \
+        case NK_FMA: return fmaf(CHILD(n->as.triple.first), CHILD(n->as.triple.second), CHILD(n->as.triple.third)); \
+        case NK_AFFINE_X: return fmaf(n->as.affine.scale, x, n->as.affine.offset); \
+        case NK_AFFINE_Y: return fmaf(n->as.affine.scale, y, n->as.affine.offset); \
+        \
+        case NK_E: \
+        case NK_IF_THEN_ELSE: \
+        default: \
+            printf("Node %u of kind %d cannot evaluate to a number!\n", index, node_kind(n)); \
+            exit(-1); \
+    }
+
+/// @brief Evaluate a channel. Same semantics as `eval_ast`, but returns the value rather than adding result nodes, and doesn't check
+/// @brief any node kinds, so the channel must have passed `check_ast` or `validate_packed_ast`
+/// @param nodes node array holding the channel, `ast.array` or a packed AST
+/// @param index
+/// @param x
+/// @param y
+/// @param fast see `EVAL_NUMBER_NODE`
+/// @return
+float eval_number(const Node* nodes, uint32_t index, float x, float y, int fast){
+#define NUMBER_CHILD(i) eval_number(nodes, i, x, y, fast)
+    EVAL_NUMBER_NODE(NUMBER_CHILD)
+#undef NUMBER_CHILD
+}
+
+/// @brief Evaluate the three channels of an AST whose root is an E, or an if-then-else of Es. Unchecked like `eval_number`
+/// @param nodes
+/// @param root
+/// @param x
+/// @param y
+/// @param fast see `EVAL_NUMBER_NODE`
+/// @param rgb
+void eval_rgb(const Node* nodes, uint32_t root, float x, float y, int fast, float rgb[3]){
+    const Node* n = nodes + root;
+
+    while(node_kind(n) == NK_IF_THEN_ELSE){
+        n = nodes + (eval_number(nodes, n->as.triple.first, x, y, fast) ? n->as.triple.second : n->as.triple.third);
+    }
+
+    rgb[0] = eval_number(nodes, n->as.triple.first, x, y, fast);
+    rgb[1] = eval_number(nodes, n->as.triple.second, x, y, fast);
+    rgb[2] = eval_number(nodes, n->as.triple.third, x, y, fast);
+}
+
 /// @brief Evaluate given AST. After evaluation, reset head to point to AST state before evaluation
 /// @param ast 
 /// @param x 
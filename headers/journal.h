@@ -0,0 +1,196 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "utils.h"
+
+/*
+    Progress journal of a batch run, so that a run that crashed or was killed resumes where it stopped. The journal is
+    an append-only text file named after the seed range and depth, with a line for every seed that is finished:
+
+        done <seed> <bytes of its png>
+        skip <seed>
+
+    Pngs are written to a temporary name and renamed before their line is appended, so a seed in the journal always has
+    its whole image, and a seed that was rendered but not journaled is rendered again to the same name, never twice. On
+    resume, seeds whose png is missing or has a different size are rendered again. Lines are appended with one write
+    each and the file is synced every `JOURNAL_SYNC_LINES` lines or `JOURNAL_SYNC_MS`, whichever comes first, and when
+    the run ends. A torn last line from a crash is cut off before anything is appended.
+*/
+
+#define JOURNAL_SYNC_LINES 64
+#define JOURNAL_SYNC_MS 1000.0
+
+typedef struct {
+    pthread_mutex_t lock;
+    int fd;
+    char path[128];
+    int refs; // the batch command and every job of it that hasn't ended
+
+    U64* done; // seeds finished by earlier runs, sorted
+    size_t n_done;
+
+    int unsynced;
+    double synced_ns;
+} Journal;
+
+int compare_seeds(const void* a, const void* b){
+    U64 x = *(const U64*)a, y = *(const U64*)b;
+
+    return (x > y) - (x < y);
+}
+
+/// @brief Read the seeds finished by earlier runs from the journal at `j->path`
+void load_journal(Journal* j){
+    FILE* f = fopen(j->path, "r");
+    size_t capacity = 0;
+    long complete = 0; // length of the complete lines
+    char line[128];
+
+    if(f == NULL){
+        return;
+    }
+
+    while(fgets(line, sizeof(line), f) != NULL){
+        unsigned long long seed;
+        long long bytes = -1;
+        char png[128];
+
+        // a line without its newline was torn by a crash
+        if(strchr(line, '\n') == NULL) break;
+
+        complete = ftell(f);
+
+        int is_done = sscanf(line, "done %llu %lld", &seed, &bytes) == 2;
+
+        if(!is_done && (sscanf(line, "skip %llu", &seed) != 1)) continue;
+
+        // rendered, but the image has gone since
+        struct stat st;
+        snprintf(png, sizeof(png), "batch_%llu.png", seed);
+
+        if(is_done && ((stat(png, &st) != 0) || (st.st_size != bytes))) continue;
+
+        if(j->n_done == capacity){
+            capacity = capacity ? capacity * 2 : 1024;
+            j->done = (U64*)realloc(j->done, sizeof(U64) * capacity);
+            assert(j->done != NULL);
+        }
+
+        j->done[j->n_done++] = seed;
+    }
+
+    fclose(f);
+
+    if(truncate(j->path, complete) != 0){
+        printf("[ERROR] could not cut the torn line off journal %s\n", j->path);
+    }
+
+    qsort(j->done, j->n_done, sizeof(U64), compare_seeds);
+}
+
+/// @brief Open the journal of the batch run of seeds `first` to `last` at `depth`, reading what earlier runs of it finished
+/// @return NULL if it can't be opened
+Journal* open_journal(U64 first, U64 last, int depth){
+    Journal* j = (Journal*)calloc(1, sizeof(Journal));
+    assert(j != NULL);
+
+    pthread_mutex_init(&j->lock, NULL);
+    snprintf(j->path, sizeof(j->path), "batch_%llu_%llu_d%d.journal", (unsigned long long)first, (unsigned long long)last, depth);
+
+    load_journal(j);
+
+    j->fd = open(j->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if(j->fd < 0){
+        printf("[ERROR] could not open journal %s\n", j->path);
+        free(j->done);
+        free(j);
+        return NULL;
+    }
+
+    j->refs = 1;
+    j->synced_ns = now_ns();
+
+    return j;
+}
+
+/// @brief 1 if an earlier run finished `seed`
+int journal_has(const Journal* j, U64 seed){
+    if((j == NULL) || (j->n_done == 0)){
+        return 0;
+    }
+
+    return bsearch(&seed, j->done, j->n_done, sizeof(U64), compare_seeds) != NULL;
+}
+
+/// @brief Append a line to the journal, syncing it if it is due
+void journal_line(Journal* j, const char* line){
+    if(j == NULL){
+        return;
+    }
+
+    pthread_mutex_lock(&j->lock);
+
+    if(write(j->fd, line, strlen(line)) != (ssize_t)strlen(line)){
+        printf("[ERROR] could not append to journal %s\n", j->path);
+    }
+
+    if((++j->unsynced >= JOURNAL_SYNC_LINES) || ((now_ns() - j->synced_ns) / 1e6 >= JOURNAL_SYNC_MS)){
+        fsync(j->fd);
+        j->unsynced = 0;
+        j->synced_ns = now_ns();
+    }
+
+    pthread_mutex_unlock(&j->lock);
+}
+
+/// @brief Record that `seed` was rendered to a png of `bytes` bytes, which must already be in place
+void journal_done(Journal* j, U64 seed, size_t bytes){
+    char line[64];
+    snprintf(line, sizeof(line), "done %llu %zu\n", (unsigned long long)seed, bytes);
+
+    journal_line(j, line);
+}
+
+/// @brief Record that `seed` has nothing to render, its AST is invalid or too expensive
+void journal_skip(Journal* j, U64 seed){
+    char line[64];
+    snprintf(line, sizeof(line), "skip %llu\n", (unsigned long long)seed);
+
+    journal_line(j, line);
+}
+
+void journal_retain(Journal* j){
+    if(j == NULL) return;
+
+    pthread_mutex_lock(&j->lock);
+    j->refs++;
+    pthread_mutex_unlock(&j->lock);
+}
+
+/// @brief Drop a reference to the journal, syncing and closing it with the last one
+void journal_release(Journal* j){
+    if(j == NULL) return;
+
+    pthread_mutex_lock(&j->lock);
+    int last = --j->refs == 0;
+    pthread_mutex_unlock(&j->lock);
+
+    if(!last){
+        return;
+    }
+
+    fsync(j->fd);
+    close(j->fd);
+    pthread_mutex_destroy(&j->lock);
+    free(j->done);
+    free(j);
+}
+
+#endif
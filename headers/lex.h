@@ -1,85 +1,189 @@
 #ifndef LEX_H
 #define LEX_H
 
-#include <regex.h>
 #include <stdio.h>
+#include <ctype.h>
 
 #include "utils.h"
+#include "ast.h"
+
+typedef enum {
+    TK_ADD,
+    TK_DIV,
+    TK_SIN,
+    TK_COS,
+    TK_EXP,
+    TK_MOD,
+    TK_MULT,
+    TK_GEQ,
+    TK_X,
+    TK_Y,
+    TK_E,
+    TK_COMMA,
+    TK_IF,
+    TK_ELSE,
+    TK_OPEN_BRACKET,
+    TK_CLOSE_BRACKET,
+    TK_NUMBER,
+    TK_END
+} Token_kind;
+
+const char* TOKEN_NAMES[] = {
+    [TK_ADD] = "add",
+    [TK_DIV] = "div",
+    [TK_SIN] = "sin",
+    [TK_COS] = "cos",
+    [TK_EXP] = "exp",
+    [TK_MOD] = "mod",
+    [TK_MULT] = "mult",
+    [TK_GEQ] = "geq",
+    [TK_X] = "x",
+    [TK_Y] = "y",
+    [TK_E] = "E",
+    [TK_COMMA] = ",",
+    [TK_IF] = "if",
+    [TK_ELSE] = "else",
+    [TK_OPEN_BRACKET] = "(",
+    [TK_CLOSE_BRACKET] = ")",
+    [TK_NUMBER] = "number",
+    [TK_END] = "end of input",
+};
+
+/// @brief Node built by the function each token names, 0 for tokens that aren't functions
+const Node_kind TOKEN_NODE_KIND[] = {
+    [TK_ADD] = NK_ADD,
+    [TK_DIV] = NK_DIV,
+    [TK_SIN] = NK_SIN,
+    [TK_COS] = NK_COS,
+    [TK_EXP] = NK_EXP,
+    [TK_MOD] = NK_MOD,
+    [TK_MULT] = NK_MULT,
+    [TK_GEQ] = NK_GEQ,
+    [TK_END] = 0,
+};
+
+/// @brief A token is a view into the lexed input, nothing is copied out of it
+typedef struct {
+    Token_kind kind;
+    size_t offset;
+    size_t length;
+} Token;
+
+/// @brief Lexer state over an input of known length, which doesn't need to be null terminated. Tokens are pulled one at a time with `next_token`
+typedef struct {
+    const char* input;
+    size_t length;
+    size_t pos;
+} Lexer;
+
+Lexer new_lexer(const char* input, size_t length){
+    return (Lexer){.input = input, .length = length, .pos = 0};
+}
 
-char* tokens[INPUT_SIZE] = {0};
-
-size_t lex(char* input, const char* PATTERNS[], size_t num_of_patterns){
-    size_t curr_token = 0;
+/// @brief Character `ahead` chars past the lexer position, `\0` past the end of the input
+char lexer_char(Lexer* l, size_t ahead){
+    return (l->pos + ahead < l->length) ? l->input[l->pos + ahead] : '\0';
+}
 
-    regex_t regex[num_of_patterns];
-    regmatch_t match;
+/// @brief Match the keyword `word` at the lexer position, setting `t` if it does
+/// @return
+int match_keyword(Lexer* l, const char* word, Token_kind kind, Token* t){
+    size_t length = strlen(word);
 
-    for(size_t i = 0; i < num_of_patterns; ++i){
-        if(regcomp(&regex[i], PATTERNS[i], REG_EXTENDED) != 0){
-            printf("Could not compile regex pattern!\n");
-            exit(-1);
-        }
+    if((l->length - l->pos < length) || strncmp(l->input + l->pos, word, length)){
+        return 0;
     }
 
-    char* cursor = input;
+    t->kind = kind;
+    t->length = length;
 
-    while(*cursor != '\0'){
-        int matched = 0;
+    return 1;
+}
 
-        if((*cursor == '\n') || (*cursor == '\t') || (*cursor == ' ')){
-            cursor ++;
-            continue;
-        }
+/// @brief Length of the number at the lexer position, of the form `-?digits(.digits)?` or `.digits`, or 0 if there isn't one
+size_t match_number(Lexer* l){
+    size_t c = 0;
 
-        for(size_t i = 0; i < num_of_patterns; ++i){
+    if(lexer_char(l, c) == '-'){
+        c++;
+    }
 
-            if(!regexec(&regex[i], cursor, 1, &match, 0) && !match.rm_so){
-                size_t length = match.rm_eo - match.rm_so;
+    if(isdigit((unsigned char)lexer_char(l, c))){
+        while(isdigit((unsigned char)lexer_char(l, c))) c++;
 
-                tokens[curr_token] = (char*) malloc(length + 1);
-                memcpy(tokens[curr_token], cursor, length);
-                tokens[curr_token][length] = '\0';
+        if((lexer_char(l, c) == '.') && isdigit((unsigned char)lexer_char(l, c + 1))){
+            c++;
+            while(isdigit((unsigned char)lexer_char(l, c))) c++;
+        }
 
-                curr_token++;
-                
-                cursor += length;
-                matched = 1;
-                break;
-            }
+        return c;
 
-        }
+    } else if((lexer_char(l, 0) == '.') && isdigit((unsigned char)lexer_char(l, 1))){
+        c = 1;
+        while(isdigit((unsigned char)lexer_char(l, c))) c++;
 
-        if(!matched){
-            printf("Could not match any of the known patterns at char %c \n", *cursor);
-            curr_token = 0;
-            break;
-        }
+        return c;
+    }
+
+    return 0;
+}
+
+/// @brief Lex one token, skipping whitespace before it, and move the lexer past it
+/// @param l
+/// @param t set to `TK_END` at the end of input
+/// @return -1 if no token can be matched at the lexer position
+int next_token(Lexer* l, Token* t){
+    char c;
 
+    while(((c = lexer_char(l, 0)) == '\n') || (c == '\t') || (c == ' ') || (c == '\r')){
+        l->pos++;
     }
 
-    for(size_t i = 0; i < num_of_patterns; ++i){
-        regfree(&regex[i]);
+    t->offset = l->pos;
+    t->length = 1;
+
+    int matched = 1;
+
+    if(l->pos >= l->length){
+        t->kind = TK_END;
+        t->length = 0;
+        return 0;
     }
 
-    #ifdef DEBUG
-    for(size_t i = 0; i < curr_token; ++i){
-        printf("val: %s \n", tokens[i]);
+    switch(c){
+        case '(': t->kind = TK_OPEN_BRACKET; break;
+        case ')': t->kind = TK_CLOSE_BRACKET; break;
+        case ',': t->kind = TK_COMMA; break;
+        case 'x': t->kind = TK_X; break;
+        case 'y': t->kind = TK_Y; break;
+        case 'E': t->kind = TK_E; break;
+        case 'a': matched = match_keyword(l, "add", TK_ADD, t); break;
+        case 'd': matched = match_keyword(l, "div", TK_DIV, t); break;
+        case 's': matched = match_keyword(l, "sin", TK_SIN, t); break;
+        case 'c': matched = match_keyword(l, "cos", TK_COS, t); break;
+        case 'g': matched = match_keyword(l, "geq", TK_GEQ, t); break;
+        case 'i': matched = match_keyword(l, "if", TK_IF, t); break;
+        case 'e': matched = match_keyword(l, "exp", TK_EXP, t) || match_keyword(l, "else", TK_ELSE, t); break;
+        case 'm': matched = match_keyword(l, "mod", TK_MOD, t) || match_keyword(l, "mult", TK_MULT, t); break;
+
+        default:
+            t->kind = TK_NUMBER;
+            t->length = match_number(l);
+            matched = t->length != 0;
     }
-    #endif
 
-    return curr_token;
+    if(!matched){
+        printf("Could not match any of the known patterns at char %c (offset %ld)\n", c, l->pos);
+        return -1;
+    }
 
-}
+    l->pos += t->length;
 
-void free_tokens(size_t num_of_tokens){
-    for(size_t i = 0; i < num_of_tokens; ++i){
-        free(tokens[i]);
-    }
     #ifdef DEBUG
-    printf("Freed memory used to store tokens\n");
+    printf("val: %.*s \n", (int)t->length, l->input + t->offset);
     #endif
+
+    return 0;
 }
 
 #endif
-
-
@@ -4,37 +4,44 @@
 #include "ast.h"
 #include "lex.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <math.h>
 
-int cursor;
+// the parser and every pass after it recurse once per level, so deeper ASTs would run out of stack
+#define PARSE_MAX_NESTING 512
+
+Lexer lexer;
+Token current; // token the parser is looking at, pulled from `lexer` one at a time
 int maybe_errors = 0;
-int NUM_OF_TOKENS;
+int nesting = 0; // of the C being parsed
+int too_deep = 0; // set once nesting goes past `PARSE_MAX_NESTING`, parsing stops without more errors
 
 void consume(){
-    if(cursor < NUM_OF_TOKENS - 1){
-        cursor++;
-    } else {
-        printf("Cannot consume any more tokens! Cursor at %d / %d\n", cursor, NUM_OF_TOKENS);
+    if(current.kind == TK_END){
+        printf("Cannot consume any more tokens! Reached end of input at offset %ld\n", current.offset);
+        maybe_errors += 1;
+
+    } else if(next_token(&lexer, &current)){
+        // stop parsing at the first unknown character
+        current = (Token){.kind = TK_END, .offset = lexer.pos};
         maybe_errors += 1;
     }
 }
 
-int token_matches(char* curr_token, char* expected){
-    return !strcmp(curr_token, expected);
+int token_matches(Token curr_token, Token_kind expected){
+    return curr_token.kind == expected;
 }
 
-void expect_syntax(char* curr_token, char* expected){
+void expect_syntax(Token curr_token, Token_kind expected){
     if(token_matches(curr_token, expected)){
-        if(cursor == NUM_OF_TOKENS - 1){
-            #ifdef DEBUG
-            printf("%s must be the last token\n", curr_token);
-            #endif
-        } else {
-            consume();
-        }
-        
+        consume();
+    } else if(too_deep){
+        maybe_errors += 1;
     } else {
-        printf("Expected %s but got %s \n", expected, curr_token);
+        printf("Expected %s but got %.*s \n", TOKEN_NAMES[expected], (int)curr_token.length, lexer.input + curr_token.offset);
         maybe_errors += 1;
     }
 }
@@ -50,11 +57,11 @@ Option parse_binop(Node_kind nk){
 
     Option lhs, rhs;
 
-    expect_syntax(tokens[cursor], "(");
+    expect_syntax(current, TK_OPEN_BRACKET);
     lhs = parse_C();
-    expect_syntax(tokens[cursor], ",");
+    expect_syntax(current, TK_COMMA);
     rhs = parse_C();
-    expect_syntax(tokens[cursor], ")");
+    expect_syntax(current, TK_CLOSE_BRACKET);
 
     return wrap_value(node_binop(nk, lhs.value, rhs.value), maybe_errors || lhs.none || rhs.none);
 }
@@ -68,9 +75,9 @@ Option parse_unop(Node_kind nk){
 
     Option node;
 
-    expect_syntax(tokens[cursor], "(");
+    expect_syntax(current, TK_OPEN_BRACKET);
     node = parse_C();
-    expect_syntax(tokens[cursor], ")");
+    expect_syntax(current, TK_CLOSE_BRACKET);
 
     return wrap_value(node_unop(nk, node.value), maybe_errors || node.none);
 }
@@ -78,30 +85,41 @@ Option parse_unop(Node_kind nk){
 Option parse_A(){
     maybe_errors = 0;
 
-    if(token_matches(tokens[cursor], "x")){
+    Token token = current;
+
+    if(token_matches(token, TK_X)){
         consume();
 
         return wrap_value(node_x, maybe_errors);
 
-    } else if (token_matches(tokens[cursor], "y")){
+    } else if (token_matches(token, TK_Y)){
         consume();
 
         return wrap_value(node_y, maybe_errors);
 
-    } else {
-        char* token = tokens[cursor];
+    } else if (token_matches(token, TK_NUMBER)){
+        char text[64];
         char* end;
-        errno = 0;
-        float num = strtof(token, &end);
-
         size_t node = 0;
 
-        if(end == token){
-            printf("Token %s is not a valid float!\n", token);
+        if(token.length >= sizeof(text)){
+            printf("Token %.*s is too long to be a number!\n", (int)token.length, lexer.input + token.offset);
+            return wrap_value(node, 1);
+        }
+
+        // copy the token out, strtof would otherwise read past it
+        memcpy(text, lexer.input + token.offset, token.length);
+        text[token.length] = '\0';
+
+        errno = 0;
+        float num = strtof(text, &end);
+
+        if(end == text){
+            printf("Token %s is not a valid float!\n", text);
             maybe_errors = 1;
 
         } else if (errno == ERANGE){
-            printf("Token %s is out of range!\n", token);
+            printf("Token %s is out of range!\n", text);
             maybe_errors = 1;
 
         } else if((num > 1.0) || (num < -1.0)){
@@ -114,55 +132,56 @@ Option parse_A(){
         }
 
         return wrap_value(node, maybe_errors);
+
+    } else {
+        printf("Token %.*s is not a valid float!\n", (int)token.length, lexer.input + token.offset);
+
+        return wrap_value(0, 1);
     }
 }
 
 Option parse_C(){
+    Node_kind nk = TOKEN_NODE_KIND[current.kind];
+    Option node;
 
-    if(token_matches(tokens[cursor], "add")){
-        return parse_binop(NK_ADD);
-        
-    } else if (token_matches(tokens[cursor], "div")){
-        return parse_binop(NK_DIV);
-
-    } else if (token_matches(tokens[cursor], "sin")){
-        return parse_unop(NK_SIN);
-
-    } else if (token_matches(tokens[cursor], "cos")){
-        return parse_unop(NK_COS);
-
-    } else if (token_matches(tokens[cursor], "exp")){
-        return parse_unop(NK_EXP);
+    if(too_deep){
+        return wrap_value(0, 1);
+    }
 
-    } else if (token_matches(tokens[cursor], "mod")){
-        return parse_binop(NK_MOD);
+    if(++nesting > PARSE_MAX_NESTING){
+        printf("AST is nested deeper than %d levels at offset %ld!\n", PARSE_MAX_NESTING, current.offset);
+        too_deep = 1;
+        node = wrap_value(0, 1);
 
-    } else if (token_matches(tokens[cursor], "mult")){
-        return parse_binop(NK_MULT);
+    } else if(nk & NK_BINOP){
+        node = parse_binop(nk);
 
-    } else if (token_matches(tokens[cursor], "geq")){
-        return parse_binop(NK_GEQ);
+    } else if (nk & NK_UNOP){
+        node = parse_unop(nk);
 
     } else {
-        return parse_A();
+        node = parse_A();
     }
 
+    nesting--;
+
+    return node;
 }
 
 Option parse_E(){
     maybe_errors = 0;
 
-    expect_syntax(tokens[cursor], "E");
+    expect_syntax(current, TK_E);
 
-    expect_syntax(tokens[cursor], "(");
+    expect_syntax(current, TK_OPEN_BRACKET);
 
     Option first = parse_C();
-    expect_syntax(tokens[cursor], ",");
+    expect_syntax(current, TK_COMMA);
     Option second = parse_C();
-    expect_syntax(tokens[cursor], ",");
+    expect_syntax(current, TK_COMMA);
     Option third = parse_C();
 
-    expect_syntax(tokens[cursor], ")");
+    expect_syntax(current, TK_CLOSE_BRACKET);
 
     return wrap_value(node_triple(NK_E, first.value, second.value, third.value), maybe_errors || first.none || second.none || third.none);
 }
@@ -170,48 +189,94 @@ Option parse_E(){
 Option parse_if(){
     maybe_errors = 0;
 
-    expect_syntax(tokens[cursor], "if");
+    expect_syntax(current, TK_IF);
 
-    expect_syntax(tokens[cursor], "(");
+    expect_syntax(current, TK_OPEN_BRACKET);
     
     Option cond = parse_C();
 
-    expect_syntax(tokens[cursor], ")");
+    expect_syntax(current, TK_CLOSE_BRACKET);
 
     Option true_body = parse_E();
 
-    expect_syntax(tokens[cursor], "else");
+    expect_syntax(current, TK_ELSE);
 
     Option false_body = parse_E();
 
     return wrap_value(node_triple(NK_IF_THEN_ELSE, cond.value, true_body.value, false_body.value), maybe_errors || cond.none || true_body.none || false_body.none);
 }
 
-int parse(char* input){
-    NUM_OF_TOKENS = lex(input, AST_PATTERNS, sizeof(AST_PATTERNS) / sizeof(AST_PATTERNS[0]));
-    cursor = 0;
+/// @brief Parse an AST from `length` bytes of `input`, in a single pass. Tokens are lexed as the parser needs them, so memory use only grows with the AST.
+/// @brief Any number of nodes is fine, but nesting is limited to `PARSE_MAX_NESTING` levels, and nothing may follow the root
+/// @param input
+/// @param length
+/// @return 0 if the AST was parsed without errors
+int parse_source(const char* input, size_t length){
+    lexer = new_lexer(input, length);
+    nesting = too_deep = 0;
 
-    if(NUM_OF_TOKENS){
-        Option ast_head;
+    if(next_token(&lexer, &current)){
+        return -1;
+    }
 
-        if(token_matches(tokens[cursor], "E")){
-            ast_head = parse_E();
+    Option ast_head;
 
-        } else if (token_matches(tokens[cursor], "if")){
-            ast_head = parse_if();
+    if(token_matches(current, TK_E)){
+        ast_head = parse_E();
 
-        } else {
-            printf("AST root should be if or E! Here %s is used \n", tokens[cursor]);
-            return -1;
-        }
+    } else if (token_matches(current, TK_IF)){
+        ast_head = parse_if();
 
-        free_tokens(NUM_OF_TOKENS);
+    } else {
+        printf("AST root should be if or E! Here %.*s is used \n", (int)current.length, input + current.offset);
+        return -1;
+    }
 
-        return ast_head.none;
+    if(!ast_head.none && !token_matches(current, TK_END)){
+        printf("Unexpected %.*s after the end of the AST!\n", (int)current.length, input + current.offset);
+        return -1;
+    }
 
-    } else {
+    return ast_head.none;
+}
+
+int parse(const char* input){
+    return parse_source(input, strlen(input));
+}
+
+/// @brief Parse an AST from a file of any size, see `parse_source` for the nesting limit. The file is mapped into memory rather than read into a buffer
+/// @param path
+/// @return 0 if the AST was parsed without errors
+int parse_file(const char* path){
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if(fd < 0){
+        printf("[ERROR] could not open %s\n", path);
         return -1;
     }
+
+    if((fstat(fd, &st) < 0) || !S_ISREG(st.st_mode) || (st.st_size == 0)){
+        printf("[ERROR] %s is not a regular non-empty file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    char* input = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(input == MAP_FAILED){
+        printf("[ERROR] could not map %s\n", path);
+        return -1;
+    }
+
+    madvise(input, st.st_size, MADV_SEQUENTIAL);
+
+    int res = parse_source(input, st.st_size);
+
+    munmap(input, st.st_size);
+
+    return res;
 }
 
 
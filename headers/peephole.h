@@ -0,0 +1,130 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "ast.h"
+#include "simplify.h"
+
+/*
+    Peephole pass, run after simplification. Common shapes are replaced by fused nodes that the evaluator dispatches once:
+
+        mult(x, k), add(x, k), and either of those scaled or offset by another constant  ->  affine in x (same for y)
+        add(mult(a, b), c)                                                                 ->  fma(a, b, c)
+
+    Trig of a scaled input, sin(add(mult(x, k1), k0)), so becomes sin of an affine leaf. Fused nodes compute with a single
+    rounding where the original nodes rounded after each operation, so results can differ from them in the last float bit.
+
+    That usually moves a pixel by one level at most, or by a few where the fused add cancels its product. Div, exp and mod
+    amplify it further and geq or an if condition can flip on it, which moved pixels by up to half the range, so below
+    those nodes only add(x, k) is fused, as it rounds exactly like the add it replaces.
+*/
+
+int is_leaf_var(Node_kind nk){
+    return (nk == NK_X) || (nk == NK_Y);
+}
+
+/// @brief Fuse a binop whose operands are already rebuilt into `ast`, or build it as is
+/// @param nk
+/// @param lhs
+/// @param rhs
+/// @param index of the binop in `source`
+/// @param exact nonzero if the result feeds a node that amplifies rounding, so only bit-exact fusion is allowed
+/// @return
+size_t fuse_binop(Node_kind nk, size_t lhs, size_t rhs, size_t index, int exact){
+    Node* l = ast.array + lhs;
+    Node* r = ast.array + rhs;
+
+    if((nk != NK_ADD) && (nk != NK_MULT)){
+        return node_binop_loc(nk, lhs, rhs, source_loc(index));
+    }
+
+    // put the constant on the right
+    if(node_kind(l) == NK_NUMBER){
+        Node* t = l; l = r; r = t;
+        size_t ti = lhs; lhs = rhs; rhs = ti;
+    }
+
+    Node_kind lk = node_kind(l);
+    int rhs_const = node_kind(r) == NK_NUMBER;
+
+    if(exact){
+        if((nk == NK_ADD) && rhs_const && is_leaf_var(lk)){
+            return node_affine_loc((lk == NK_X) ? NK_AFFINE_X : NK_AFFINE_Y, 1, r->as.number, source_loc(index));
+        }
+
+        return node_binop_loc(nk, lhs, rhs, source_loc(index));
+    }
+
+    if(rhs_const && is_leaf_var(lk)){
+        Node_kind affine = (lk == NK_X) ? NK_AFFINE_X : NK_AFFINE_Y;
+
+        return (nk == NK_MULT) ? node_affine_loc(affine, r->as.number, 0, source_loc(index)) :
+            node_affine_loc(affine, 1, r->as.number, source_loc(index));
+    }
+
+    if(rhs_const && (lk & NK_AFFINE)){
+        Affine a = l->as.affine;
+        float k = r->as.number;
+
+        return (nk == NK_MULT) ? node_affine_loc(lk, a.scale * k, a.offset * k, source_loc(index)) :
+            node_affine_loc(lk, a.scale, a.offset + k, source_loc(index));
+    }
+
+    if(nk == NK_ADD){
+        // either operand can be the product
+        if(node_kind(ast.array + rhs) == NK_MULT){
+            size_t t = lhs; lhs = rhs; rhs = t;
+        }
+
+        Node* product = ast.array + lhs;
+
+        if(node_kind(product) == NK_MULT){
+            return node_fma_loc(product->as.binop.lhs, product->as.binop.rhs, rhs, source_loc(index));
+        }
+    }
+
+    return node_binop_loc(nk, lhs, rhs, source_loc(index));
+}
+
+/// @brief Rebuild the subtree at `index` in `source` into `ast`, with fused nodes where possible
+/// @param index
+/// @param exact nonzero below a div, exp, mod, geq or if condition
+/// @return
+size_t peephole_node(size_t index, int exact){
+    Node n = source.array[index];
+    Node_kind nk = node_kind(&n);
+    int below = exact || (nk & (NK_DIV | NK_EXP | NK_MOD | NK_GEQ));
+
+    if(nk & NK_UNOP){
+        return node_unop_loc(nk, peephole_node(n.as.unop, below), source_loc(index));
+
+    } else if (nk & NK_BINOP){
+        size_t lhs = peephole_node(n.as.binop.lhs, below);
+        size_t rhs = peephole_node(n.as.binop.rhs, below);
+
+        return fuse_binop(nk, lhs, rhs, index, exact);
+
+    } else if (nk & (NK_TRIPLE | NK_TERNOP)){
+        n.as.triple.first = peephole_node(n.as.triple.first, exact || (nk == NK_IF_THEN_ELSE));
+        n.as.triple.second = peephole_node(n.as.triple.second, exact);
+        n.as.triple.third = peephole_node(n.as.triple.third, exact);
+    }
+
+    return add_node_to_ast(n, source_loc(index));
+}
+
+size_t peephole_root(size_t index){
+    return peephole_node(index, 0);
+}
+
+/// @brief Replace common shapes in the AST rooted at `ast.ast_root` with fused nodes. Like `simplify_ast`, the result holds only reachable nodes, with its root last
+/// @return number of nodes removed
+size_t peephole_ast(){
+    size_t before = count_nodes(ast.ast_root);
+
+    rebuild_ast(peephole_root);
+    rebuild_ast(copy_node); // drop the nodes that were fused
+
+    return before - ast.used;
+}
+
+#endif
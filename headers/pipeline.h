@@ -0,0 +1,442 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "utils.h"
+#include "search.h"
+#include "render.h"
+#include "cache.h"
+#include "journal.h"
+
+/*
+    Staged batch pipeline: generate -> render -> encode -> write, each stage with its own threads and a bounded queue
+    to the next. Generation stays on the main thread, since it depends on the global `rand` state and on `ast`, and
+    hands each stage after it a snapshot of the AST with its render already prepared. Render threads render whole images
+    on their own, encode threads turn them into pngs, and write threads put them in place, in the render cache and in
+    the journal, as `batch` does.
+
+    Queues are lock-free rings of `PIPELINE_QUEUE` slots that any number of threads push to and pop from (Vyukov's bounded
+    MPMC queue): each slot has a sequence number that says whether it is free for the push or the pop of the current lap.
+    A thread that finds its queue full or empty spins for a while, then sleeps in short naps, so when a stage falls
+    behind the ones before it stop, and there are never more images in flight than the queues and threads can hold.
+
+    Every stage counts the time its threads spend working (busy), waiting for something to work on (starved) and waiting
+    for room in the next queue (blocked). The stage that is busiest per thread is the bottleneck.
+*/
+
+#define PIPELINE_QUEUE 8 // slots of each queue, a power of 2
+#define PIPELINE_MAX_THREADS 16
+#define PIPELINE_SPINS 64 // tries before napping
+#define PIPELINE_NAP_NS 100000
+
+typedef struct {
+    size_t seq;
+    void* item;
+} Ring_cell;
+
+typedef struct {
+    Ring_cell cells[PIPELINE_QUEUE];
+    size_t head __attribute__((aligned(CACHE_LINE))); // next slot to pop
+    size_t tail __attribute__((aligned(CACHE_LINE))); // next slot to push
+    int closed; // nothing more will be pushed
+} Ring;
+
+void init_ring(Ring* q){
+    for(size_t i = 0; i < PIPELINE_QUEUE; ++i){
+        q->cells[i] = (Ring_cell){.seq = i, .item = NULL};
+    }
+
+    q->head = q->tail = 0;
+    q->closed = 0;
+}
+
+/// @return -1 if the ring is full
+int ring_push(Ring* q, void* item){
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    Ring_cell* cell;
+
+    for(;;){
+        cell = q->cells + (pos & (PIPELINE_QUEUE - 1));
+        intptr_t diff = (intptr_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (intptr_t)pos;
+
+        if(diff < 0){
+            // the pop of the last lap hasn't happened
+            return -1;
+        }
+
+        if((diff == 0) && __atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+            break;
+        }
+
+        // another thread took the slot, or the compare exchange reloaded `pos`
+        if(diff > 0) pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+
+    cell->item = item;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/// @return NULL if the ring is empty
+void* ring_pop(Ring* q){
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    Ring_cell* cell;
+
+    for(;;){
+        cell = q->cells + (pos & (PIPELINE_QUEUE - 1));
+        intptr_t diff = (intptr_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (intptr_t)(pos + 1);
+
+        if(diff < 0){
+            // the push of this lap hasn't happened
+            return NULL;
+        }
+
+        if((diff == 0) && __atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+            break;
+        }
+
+        if(diff > 0) pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+
+    void* item = cell->item;
+    __atomic_store_n(&cell->seq, pos + PIPELINE_QUEUE, __ATOMIC_RELEASE);
+
+    return item;
+}
+
+/// @brief Back off after the `tries`th failed push or pop in a row
+void ring_wait(int tries){
+    if(tries < PIPELINE_SPINS){
+        sched_yield();
+    } else {
+        struct timespec nap = {0, PIPELINE_NAP_NS};
+        nanosleep(&nap, NULL);
+    }
+}
+
+void ring_push_wait(Ring* q, void* item){
+    for(int tries = 0; ring_push(q, item) != 0; ++tries){
+        ring_wait(tries);
+    }
+}
+
+/// @return NULL once the ring is closed and empty
+void* ring_pop_wait(Ring* q){
+    for(int tries = 0; ; ++tries){
+        void* item = ring_pop(q);
+
+        if(item != NULL){
+            return item;
+        }
+
+        // every push happened before the ring was closed, so one more pop sees them all
+        if(__atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)){
+            return ring_pop(q);
+        }
+
+        ring_wait(tries);
+    }
+}
+
+void close_ring(Ring* q){
+    __atomic_store_n(&q->closed, 1, __ATOMIC_RELEASE);
+}
+
+/// @brief Work of a stage on one item
+/// @return the item to pass to the next stage, NULL if it is done with it
+typedef void* (*Stage_func)(void* item);
+
+typedef struct {
+    const char* name;
+    int n_threads;
+    pthread_t threads[PIPELINE_MAX_THREADS];
+    int running; // threads that haven't finished, the last one closes `out`
+
+    Stage_func work;
+    Ring* in;
+    Ring* out; // NULL for the last stage
+
+    // summed over the stage's threads
+    U64 busy_ns;
+    U64 starved_ns;
+    U64 blocked_ns;
+    U64 items;
+} Stage;
+
+typedef enum {
+    STAGE_GENERATE,
+    STAGE_RENDER,
+    STAGE_ENCODE,
+    STAGE_WRITE,
+    N_STAGES
+} Stage_index;
+
+/// @brief An image on its way through the pipeline
+typedef struct {
+    Render r;
+    Node* nodes; // snapshot of the AST
+    char path[64];
+    char cache_as[CACHE_NAME_SIZE]; // empty if not cached
+    U64 seed;
+    Text png;
+} Pipeline_item;
+
+typedef struct {
+    Stage stages[N_STAGES];
+    Ring queues[N_STAGES - 1]; // into every stage but the first
+    Journal* journal;
+    int failed;
+} Pipeline;
+
+Pipeline pipeline;
+
+/// @brief Render an image on the calling thread alone, running the units of each phase of its render job in order
+void* render_item(void* arg){
+    Pipeline_item* item = (Pipeline_item*)arg;
+
+    for(int phase = -1, units = render_next_phase(&item->r, -1); units; units = render_next_phase(&item->r, phase)){
+        phase++;
+
+        for(int u = 0; u < units; ++u){
+            render_unit(&item->r, phase, u);
+        }
+    }
+
+    finish_render(&item->r, NULL);
+    free(item->nodes);
+    item->nodes = NULL;
+
+    return item;
+}
+
+void* encode_item(void* arg){
+    Pipeline_item* item = (Pipeline_item*)arg;
+    int length;
+
+    unsigned char* png = stbi_write_png_to_mem((const unsigned char*)*item->r.canvas, sizeof(Pixel) * IMAGE_SIZE, IMAGE_SIZE, IMAGE_SIZE, 4, &length);
+    assert(png != NULL);
+
+    text_append(&item->png, png, length);
+
+    free(png);
+    free(item->r.canvas);
+    item->r.canvas = NULL;
+
+    return item;
+}
+
+void* write_item(void* arg){
+    Pipeline_item* item = (Pipeline_item*)arg;
+
+    if(write_file(item->path, item->png.data, item->png.used) != 0){
+        printf("[ERROR] could not write %s\n", item->path);
+        __atomic_store_n(&pipeline.failed, 1, __ATOMIC_RELAXED);
+
+    } else {
+        if(item->cache_as[0]){
+            cache_write(item->cache_as, item->png.data, item->png.used);
+        }
+
+        journal_done(pipeline.journal, item->seed, item->png.used);
+    }
+
+    free(item->png.data);
+    free(item);
+
+    return NULL;
+}
+
+void* stage_thread(void* arg){
+    Stage* s = (Stage*)arg;
+
+    for(;;){
+        double start_ns = now_ns();
+        void* item = ring_pop_wait(s->in);
+        double popped_ns = now_ns();
+
+        __atomic_add_fetch(&s->starved_ns, (U64)(popped_ns - start_ns), __ATOMIC_RELAXED);
+
+        if(item == NULL){
+            break;
+        }
+
+        item = s->work(item);
+        double worked_ns = now_ns();
+
+        if(item != NULL){
+            ring_push_wait(s->out, item);
+        }
+
+        __atomic_add_fetch(&s->busy_ns, (U64)(worked_ns - popped_ns), __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->blocked_ns, (U64)(now_ns() - worked_ns), __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->items, 1, __ATOMIC_RELAXED);
+    }
+
+    if((__atomic_sub_fetch(&s->running, 1, __ATOMIC_ACQ_REL) == 0) && (s->out != NULL)){
+        close_ring(s->out);
+    }
+
+    return NULL;
+}
+
+/// @brief Print how each stage spent its threads' time, and which one held the others back
+void print_pipeline(double wall_ns){
+    int bottleneck = 0;
+    double most_busy = -1;
+
+    printf("%-10s %7s %7s %7s %8s %8s\n", "stage", "threads", "images", "busy", "starved", "blocked");
+
+    for(int i = 0; i < N_STAGES; ++i){
+        Stage* s = pipeline.stages + i;
+        double total = wall_ns * s->n_threads;
+        double busy = s->busy_ns / total;
+
+        printf("%-10s %7d %7llu %6.1f%% %7.1f%% %7.1f%%\n", s->name, s->n_threads, (unsigned long long)s->items, 100 * busy,
+            100 * s->starved_ns / total, 100 * s->blocked_ns / total);
+
+        if(busy > most_busy){
+            most_busy = busy;
+            bottleneck = i;
+        }
+    }
+
+    printf("Bottleneck: %s\n", pipeline.stages[bottleneck].name);
+}
+
+/// @brief Render seeds `first` to `last` at `depth` to `batch_<seed>.png` through the staged pipeline, see the comment at the top
+/// @brief of pipeline.h. Seeds are journaled and cached as they are by `batch`, but this returns once every image is written
+/// @param first
+/// @param last
+/// @param depth
+/// @param threads of the render, encode and write stages, at most `PIPELINE_MAX_THREADS` each
+/// @return 0 if every image was written
+int run_pipeline(U64 first, U64 last, int depth, const int threads[3]){
+    const char* names[N_STAGES] = {"generate", "render", "encode", "write"};
+    Stage_func work[N_STAGES] = {NULL, render_item, encode_item, write_item};
+    int resumed = 0, cached = 0, skipped = 0;
+
+    pipeline = (Pipeline){0};
+
+    for(int i = 0; i < N_STAGES; ++i){
+        Stage* s = pipeline.stages + i;
+
+        *s = (Stage){.name = names[i], .n_threads = i ? threads[i - 1] : 1, .work = work[i]};
+        s->in = i ? pipeline.queues + i - 1 : NULL;
+        s->out = (i < N_STAGES - 1) ? pipeline.queues + i : NULL;
+        s->running = s->n_threads;
+    }
+
+    for(int i = 0; i < N_STAGES - 1; ++i){
+        init_ring(pipeline.queues + i);
+    }
+
+    pipeline.journal = open_journal(first, last, depth);
+    init_pool();
+
+    double start_ns = now_ns();
+
+    for(int i = STAGE_RENDER; i < N_STAGES; ++i){
+        Stage* s = pipeline.stages + i;
+
+        for(int t = 0; t < s->n_threads; ++t){
+            if(pthread_create(s->threads + t, NULL, stage_thread, s) != 0){
+                printf("[ERROR] could not start %s thread %d\n", s->name, t);
+                exit(-1);
+            }
+        }
+    }
+
+    Stage* generate = pipeline.stages + STAGE_GENERATE;
+
+    for(U64 s = first; s <= last; ++s){
+        double begin_ns = now_ns();
+        char path[64];
+        char name[CACHE_NAME_SIZE];
+        Render_plan plan = {0};
+
+        snprintf(path, sizeof(path), "batch_%llu.png", (unsigned long long)s);
+
+        int done = journal_has(pipeline.journal, s);
+
+        if(done){
+            resumed++;
+
+        } else if((build_seed(s, depth, 0) != 0) || (plan = plan_render(analyse_cost(ast.ast_root))).refuse){
+            journal_skip(pipeline.journal, s);
+            skipped++;
+            done = 1;
+
+        } else {
+            cache_name(name, cache.enabled ? ast_hash() : 0, IMAGE_SIZE, plan.size, 0, "png");
+
+            if(cache_fetch(name, path) == 0){
+                struct stat st;
+                if(stat(path, &st) == 0) journal_done(pipeline.journal, s, st.st_size);
+
+                cached++;
+                done = 1;
+            }
+        }
+
+        if(!done){
+            Pipeline_item* item = (Pipeline_item*)calloc(1, sizeof(Pipeline_item));
+            assert(item != NULL);
+
+            item->nodes = (Node*)malloc(sizeof(Node) * ast.size);
+            assert(item->nodes != NULL);
+            memcpy(item->nodes, ast.array, sizeof(Node) * ast.size);
+
+            item->r = (Render){.nodes = item->nodes, .size = plan.size, .scale = IMAGE_SIZE / plan.size};
+            item->seed = s;
+            snprintf(item->path, sizeof(item->path), "%s", path);
+            snprintf(item->cache_as, sizeof(item->cache_as), "%s", cache.enabled ? name : "");
+
+            prepare_render(&item->r, 0);
+
+            double made_ns = now_ns();
+            ring_push_wait(generate->out, item);
+
+            generate->busy_ns += made_ns - begin_ns;
+            generate->blocked_ns += now_ns() - made_ns;
+            generate->items++;
+
+        } else {
+            generate->busy_ns += now_ns() - begin_ns;
+        }
+
+        if(s == last) break; // the range may end at the largest seed
+    }
+
+    close_ring(generate->out);
+
+    for(int i = STAGE_RENDER; i < N_STAGES; ++i){
+        for(int t = 0; t < pipeline.stages[i].n_threads; ++t){
+            pthread_join(pipeline.stages[i].threads[t], NULL);
+        }
+    }
+
+    double wall_ns = now_ns() - start_ns;
+
+    journal_release(pipeline.journal);
+
+    printf("Wrote %llu images in %.2f s", (unsigned long long)pipeline.stages[STAGE_WRITE].items, wall_ns / 1e9);
+
+    if(resumed) printf(", %d were finished by earlier runs", resumed);
+    if(cached) printf(", %d copied from the render cache", cached);
+    if(skipped) printf(", skipped %d seeds with invalid or too expensive ASTs", skipped);
+
+    printf("\n");
+
+    if(pipeline.stages[STAGE_GENERATE].items){
+        print_pipeline(wall_ns);
+    }
+
+    return pipeline.failed ? -1 : 0;
+}
+
+#endif
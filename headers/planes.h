@@ -0,0 +1,363 @@
+#ifndef PLANES_H
+#define PLANES_H
+
+#include <stdio.h>
+#include "ast.h"
+#include "interpreter.h"
+#include "hash.h"
+
+/*
+    Subtree plane cache. Renders at the prompt keep the samples of their biggest subtrees, one float plane per subtree,
+    keyed by the subtree's structural hash (see hash.h) and the grid. When the AST is edited, by tweaking a constant or
+    swapping a subtree and rendering again, every subtree off the path from the edit to the root hashes the same as
+    before, so its samples are read back instead of evaluated, and only the path is re-evaluated.
+
+    Planes are filled row by row ahead of the rows that read them, in node order, so a plane only depends on planes of
+    the same row that were filled before it. They are filled on every pixel, mirrored and tile filled ones included, so
+    they can be reused by renders that mirror or fill differently. A plane only goes into the cache once its render has
+    finished. The cache holds at most `budget` bytes, least recently used planes are dropped first.
+*/
+
+#define PLANE_CACHE_MB 64
+#define PLANE_MIN_NODES 8 // smaller subtrees are cheaper to evaluate than to read back
+
+typedef struct {
+    U64 hash;
+    int size;
+    int fast; // filled with fast math, see `EVAL_NUMBER_NODE`
+    float* data;
+    double used_ns;
+    int users; // renders reading it
+} Plane;
+
+typedef struct {
+    Plane* planes;
+    size_t n_planes;
+    size_t capacity;
+    size_t bytes;
+    size_t budget;
+
+    size_t reused;
+    size_t filled;
+} Plane_cache;
+
+Plane_cache plane_cache = {.budget = (size_t)PLANE_CACHE_MB << 20};
+
+/// @brief Planes used by one render, indexed by node
+typedef struct {
+    float** node_plane; // samples of each node, NULL if it is evaluated
+    unsigned char* below; // 1 if the node or one of its descendants has a plane
+    uint32_t* fill; // nodes whose planes this render fills, in node order
+    int n_fill;
+    int n_reused;
+    int size;
+    int fast; // math tier of the render, see `EVAL_NUMBER_NODE`
+} Plane_set;
+
+/// @brief Evaluate node `index` at pixel `pixel`, reading the planes of its descendants, but not its own. Expanded from `EVAL_NUMBER_NODE` like `eval_number`
+float eval_plane_node(const Node* nodes, const Plane_set* ps, uint32_t index, float x, float y, size_t pixel);
+
+/// @brief `eval_number`, reading the samples of nodes that have planes
+float eval_planes(const Node* nodes, const Plane_set* ps, uint32_t index, float x, float y, size_t pixel){
+    if(ps->node_plane[index] != NULL){
+        return ps->node_plane[index][pixel];
+    }
+
+    if(!ps->below[index]){
+        return eval_number(nodes, index, x, y, ps->fast);
+    }
+
+    return eval_plane_node(nodes, ps, index, x, y, pixel);
+}
+
+float eval_plane_node(const Node* nodes, const Plane_set* ps, uint32_t index, float x, float y, size_t pixel){
+    int fast = ps->fast;
+
+#define PLANE_CHILD(i) eval_planes(nodes, ps, i, x, y, pixel)
+    EVAL_NUMBER_NODE(PLANE_CHILD)
+#undef PLANE_CHILD
+}
+
+/// @brief `eval_rgb`, reading the samples of nodes that have planes
+void eval_rgb_planes(const Node* nodes, const Plane_set* ps, uint32_t root, float x, float y, size_t pixel, float rgb[3]){
+    const Node* n = nodes + root;
+
+    while(node_kind(n) == NK_IF_THEN_ELSE){
+        n = nodes + (eval_planes(nodes, ps, n->as.triple.first, x, y, pixel) ? n->as.triple.second : n->as.triple.third);
+    }
+
+    rgb[0] = eval_planes(nodes, ps, n->as.triple.first, x, y, pixel);
+    rgb[1] = eval_planes(nodes, ps, n->as.triple.second, x, y, pixel);
+    rgb[2] = eval_planes(nodes, ps, n->as.triple.third, x, y, pixel);
+}
+
+/// @brief Fill row `int_y` of the planes this render fills
+void fill_planes_row(const Node* nodes, const Plane_set* ps, int int_y){
+    int size = ps->size;
+    float f_y = ((float)int_y / (float)size) * 2.0 - 1.0;
+
+    for(int i = 0; i < ps->n_fill; ++i){
+        uint32_t index = ps->fill[i];
+        float* row = ps->node_plane[index] + (size_t)int_y * size;
+
+        for(int int_x = 0; int_x < size; ++int_x){
+            float f_x = ((float)int_x / (float)size) * 2.0 - 1.0;
+
+            row[int_x] = eval_plane_node(nodes, ps, index, f_x, f_y, (size_t)int_y * size + int_x);
+        }
+    }
+}
+
+Plane* find_plane(U64 hash, int size, int fast){
+    for(size_t i = 0; i < plane_cache.n_planes; ++i){
+        Plane* p = plane_cache.planes + i;
+
+        if((p->hash == hash) && (p->size == size) && (p->fast == fast)) return p;
+    }
+
+    return NULL;
+}
+
+/// @brief Drop least recently used planes that no render is reading until `extra` more bytes fit in the budget
+void evict_planes(size_t extra){
+    while(plane_cache.bytes + extra > plane_cache.budget){
+        Plane* oldest = NULL;
+
+        for(size_t i = 0; i < plane_cache.n_planes; ++i){
+            Plane* p = plane_cache.planes + i;
+
+            if(!p->users && ((oldest == NULL) || (p->used_ns < oldest->used_ns))) oldest = p;
+        }
+
+        if(oldest == NULL){
+            return;
+        }
+
+        plane_cache.bytes -= sizeof(float) * oldest->size * oldest->size;
+        free(oldest->data);
+        *oldest = plane_cache.planes[--plane_cache.n_planes];
+    }
+}
+
+/// @brief Work out which nodes of the AST held in `ast` are read from cached planes and which get planes filled, for a render on a `size`
+/// @brief grid. Only the nodes `eval_number` is called on are considered, so channels that are rendered otherwise are skipped
+/// @param size
+/// @param skip_channel for each channel of an E root, 1 if it isn't evaluated with `eval_number`
+/// @param fast math tier of the render, planes filled with the other tier aren't reused
+/// @return the planes, or NULL if no node is worth a plane
+Plane_set* attach_planes(int size, const int skip_channel[3], int fast){
+    size_t plane_bytes = sizeof(float) * size * size;
+
+    if(plane_cache.budget < plane_bytes){
+        return NULL;
+    }
+
+    Plane_set* ps = (Plane_set*)calloc(1, sizeof(Plane_set));
+    U64* hashes = (U64*)malloc(sizeof(U64) * ast.size);
+    uint32_t* nodes_below = (uint32_t*)calloc(ast.size, sizeof(uint32_t));
+    unsigned char* reached = (unsigned char*)calloc(ast.size, 1); // 1 if evaluated, 2 if its plane is filled by this render
+
+    ps->node_plane = (float**)calloc(ast.size, sizeof(float*));
+    ps->below = (unsigned char*)calloc(ast.size, 1);
+    ps->fill = (uint32_t*)malloc(sizeof(uint32_t) * ast.size);
+    ps->size = size;
+    ps->fast = fast;
+    assert((ps->node_plane != NULL) && (ps->below != NULL) && (ps->fill != NULL) && (hashes != NULL) && (nodes_below != NULL) && (reached != NULL));
+
+    hash_nodes(ast.array, ast.size, hashes);
+
+    // subtree sizes, children come first
+    for(size_t i = 0; i < ast.size; ++i){
+        const Node* n = ast.array + i;
+        Node_kind nk = node_kind(n);
+
+        nodes_below[i] = 1;
+
+        if(nk & NK_UNOP){
+            nodes_below[i] += nodes_below[n->as.unop];
+        } else if(nk & NK_BINOP){
+            nodes_below[i] += nodes_below[n->as.binop.lhs] + nodes_below[n->as.binop.rhs];
+        } else if(nk & (NK_TRIPLE | NK_TERNOP)){
+            nodes_below[i] += nodes_below[n->as.triple.first] + nodes_below[n->as.triple.second] + nodes_below[n->as.triple.third];
+        }
+    }
+
+    // from the root down, reusing cached planes, under which nothing is evaluated
+    uint32_t root = ast.size - 1;
+    reached[root] = 1;
+
+    for(size_t i = ast.size; i-- > 0;){
+        const Node* n = ast.array + i;
+        Node_kind nk = node_kind(n);
+
+        if(!reached[i]) continue;
+
+        if(!(nk & (NK_TRIPLE)) && (nodes_below[i] >= PLANE_MIN_NODES)){
+            Plane* p = find_plane(hashes[i], size, fast);
+
+            if(p != NULL){
+                ps->node_plane[i] = p->data;
+                p->users++;
+                p->used_ns = now_ns();
+                ps->n_reused++;
+                continue;
+            }
+        }
+
+        if(nk & NK_UNOP){
+            reached[n->as.unop] = 1;
+        } else if(nk & NK_BINOP){
+            reached[n->as.binop.lhs] = reached[n->as.binop.rhs] = 1;
+        } else if(nk & (NK_TRIPLE | NK_TERNOP)){
+            int split = (i == root) && (nk == NK_E);
+
+            reached[n->as.triple.first] |= !(split && skip_channel[0]);
+            reached[n->as.triple.second] |= !(split && skip_channel[1]);
+            reached[n->as.triple.third] |= !(split && skip_channel[2]);
+        }
+    }
+
+    // the biggest subtrees that are still evaluated get planes, as many as fit the budget beside the planes being read
+    size_t pinned = 0;
+
+    for(size_t i = 0; i < plane_cache.n_planes; ++i){
+        pinned += plane_cache.planes[i].users ? sizeof(float) * plane_cache.planes[i].size * plane_cache.planes[i].size : 0;
+    }
+
+    size_t room = (pinned < plane_cache.budget) ? (plane_cache.budget - pinned) / plane_bytes : 0;
+
+    while(room > 0){
+        int64_t best = -1;
+
+        for(size_t i = 0; i < ast.size; ++i){
+            Node_kind nk = node_kind(ast.array + i);
+
+            if(!reached[i] || (ps->node_plane[i] != NULL) || (nk & NK_TRIPLE) || (nodes_below[i] < PLANE_MIN_NODES)) continue;
+
+            if((best < 0) || (nodes_below[i] > nodes_below[best])) best = i;
+        }
+
+        if(best < 0) break;
+
+        ps->node_plane[best] = (float*)malloc(plane_bytes);
+        assert(ps->node_plane[best] != NULL);
+        reached[best] = 2;
+        room--;
+    }
+
+    for(size_t i = 0; i < ast.size; ++i){
+        const Node* n = ast.array + i;
+        Node_kind nk = node_kind(n);
+
+        if(reached[i] == 2){
+            ps->fill[ps->n_fill++] = i;
+        }
+
+        ps->below[i] = ps->node_plane[i] != NULL;
+
+        if(nk & NK_UNOP){
+            ps->below[i] |= ps->below[n->as.unop];
+        } else if(nk & NK_BINOP){
+            ps->below[i] |= ps->below[n->as.binop.lhs] | ps->below[n->as.binop.rhs];
+        } else if(nk & (NK_TRIPLE | NK_TERNOP)){
+            ps->below[i] |= ps->below[n->as.triple.first] | ps->below[n->as.triple.second] | ps->below[n->as.triple.third];
+        }
+    }
+
+    free(hashes);
+    free(nodes_below);
+    free(reached);
+
+    if(!ps->n_fill && !ps->n_reused){
+        free(ps->node_plane);
+        free(ps->below);
+        free(ps->fill);
+        free(ps);
+
+        return NULL;
+    }
+
+    return ps;
+}
+
+/// @brief Hand the planes a render read back to the cache, and add the planes it filled if it finished
+/// @param ps from `attach_planes`
+/// @param nodes the AST that was rendered
+/// @param count nodes in it
+/// @param finished 0 if the render was abandoned or cancelled, its planes are incomplete
+void detach_planes(Plane_set* ps, const Node* nodes, size_t count, int finished){
+    U64* hashes = (U64*)malloc(sizeof(U64) * count);
+    assert(hashes != NULL);
+
+    hash_nodes(nodes, count, hashes);
+
+    for(size_t i = 0; i < count; ++i){
+        if(ps->node_plane[i] == NULL) continue;
+
+        Plane* p = find_plane(hashes[i], ps->size, ps->fast);
+
+        if((p != NULL) && (p->data == ps->node_plane[i])){
+            p->users--;
+        }
+    }
+
+    plane_cache.reused += ps->n_reused;
+
+    for(int f = 0; f < ps->n_fill; ++f){
+        uint32_t i = ps->fill[f];
+        size_t plane_bytes = sizeof(float) * ps->size * ps->size;
+
+        // identical subtrees fill a plane each, only the first is kept
+        if(!finished || (find_plane(hashes[i], ps->size, ps->fast) != NULL)){
+            free(ps->node_plane[i]);
+            continue;
+        }
+
+        evict_planes(plane_bytes);
+
+        // the rest of the budget is read by other renders
+        if(plane_cache.bytes + plane_bytes > plane_cache.budget){
+            free(ps->node_plane[i]);
+            continue;
+        }
+
+        if(plane_cache.n_planes == plane_cache.capacity){
+            plane_cache.capacity = plane_cache.capacity ? plane_cache.capacity * 2 : 64;
+            plane_cache.planes = (Plane*)realloc(plane_cache.planes, sizeof(Plane) * plane_cache.capacity);
+            assert(plane_cache.planes != NULL);
+        }
+
+        plane_cache.planes[plane_cache.n_planes++] = (Plane){.hash = hashes[i], .size = ps->size, .fast = ps->fast, .data = ps->node_plane[i], .used_ns = now_ns()};
+        plane_cache.bytes += plane_bytes;
+        plane_cache.filled++;
+    }
+
+    free(hashes);
+    free(ps->node_plane);
+    free(ps->below);
+    free(ps->fill);
+    free(ps);
+}
+
+/// @brief Change the memory budget of the cache, 0 turns it off
+void set_plane_budget(size_t mb){
+    plane_cache.budget = mb << 20;
+    evict_planes(0);
+}
+
+void print_planes(){
+    printf("Subtree plane cache: %zu planes, %.1f of %zu MB, %zu reused and %zu filled so far\n", plane_cache.n_planes,
+        plane_cache.bytes / 1048576.0, plane_cache.budget >> 20, plane_cache.reused, plane_cache.filled);
+}
+
+void free_planes(){
+    for(size_t i = 0; i < plane_cache.n_planes; ++i){
+        free(plane_cache.planes[i].data);
+    }
+
+    free(plane_cache.planes);
+    plane_cache.planes = NULL;
+    plane_cache.n_planes = plane_cache.capacity = plane_cache.bytes = 0;
+}
+
+#endif
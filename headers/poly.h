@@ -0,0 +1,186 @@
+#ifndef POLY_H
+#define POLY_H
+
+#include "ast.h"
+
+/*
+    Subtrees made only of add, mult, x, y and numbers (and the fused forms of these) are bivariate polynomials. Once expanded into coefficient form, a
+    polynomial of degree d in x is evaluated along a scanline with forward differences: d additions per pixel, however big
+    the subtree was. Coefficients are kept in double, so results can differ from the interpreter in the last float bit.
+*/
+
+#define POLY_MAX_DEGREE 12 // in each of x and y, past this expansion is abandoned
+#define POLY_NS_PER_DEGREE 1.0 // cost of one forward difference step, for the cost model
+
+typedef struct {
+    double coef[POLY_MAX_DEGREE + 1][POLY_MAX_DEGREE + 1]; // coef[i][j] multiplies x^i y^j
+    int degree_x;
+    int degree_y;
+} Poly;
+
+/// @brief p = lhs + rhs
+int poly_add(const Poly* lhs, const Poly* rhs, Poly* p){
+    memset(p, 0, sizeof(Poly));
+
+    p->degree_x = (lhs->degree_x > rhs->degree_x) ? lhs->degree_x : rhs->degree_x;
+    p->degree_y = (lhs->degree_y > rhs->degree_y) ? lhs->degree_y : rhs->degree_y;
+
+    for(int i = 0; i <= p->degree_x; ++i){
+        for(int j = 0; j <= p->degree_y; ++j){
+            p->coef[i][j] = lhs->coef[i][j] + rhs->coef[i][j];
+        }
+    }
+
+    return 0;
+}
+
+/// @brief p = lhs * rhs
+/// @return -1 if the product would go past `POLY_MAX_DEGREE`
+int poly_mult(const Poly* lhs, const Poly* rhs, Poly* p){
+    memset(p, 0, sizeof(Poly));
+
+    p->degree_x = lhs->degree_x + rhs->degree_x;
+    p->degree_y = lhs->degree_y + rhs->degree_y;
+
+    if((p->degree_x > POLY_MAX_DEGREE) || (p->degree_y > POLY_MAX_DEGREE)){
+        return -1;
+    }
+
+    for(int i = 0; i <= lhs->degree_x; ++i){
+        for(int j = 0; j <= lhs->degree_y; ++j){
+            if(lhs->coef[i][j] == 0) continue;
+
+            for(int k = 0; k <= rhs->degree_x; ++k){
+                for(int l = 0; l <= rhs->degree_y; ++l){
+                    p->coef[i + k][j + l] += lhs->coef[i][j] * rhs->coef[k][l];
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/// @brief Expand the subtree at `index` into coefficient form
+/// @param index
+/// @param p
+/// @return 0 on success, -1 if the subtree is not a polynomial or its degree would go past `POLY_MAX_DEGREE`
+int expand_poly(size_t index, Poly* p){
+    Node* n = ast.array + index;
+    Node_kind nk = node_kind(n);
+
+    memset(p, 0, sizeof(Poly));
+
+    if(nk == NK_NUMBER){
+        p->coef[0][0] = n->as.number;
+
+    } else if (nk == NK_X){
+        p->coef[1][0] = 1;
+        p->degree_x = 1;
+
+    } else if (nk == NK_Y){
+        p->coef[0][1] = 1;
+        p->degree_y = 1;
+
+    } else if (nk & NK_AFFINE){
+        p->coef[0][0] = n->as.affine.offset;
+
+        if(nk == NK_AFFINE_X){
+            p->coef[1][0] = n->as.affine.scale;
+            p->degree_x = 1;
+        } else {
+            p->coef[0][1] = n->as.affine.scale;
+            p->degree_y = 1;
+        }
+
+    } else if ((nk == NK_ADD) || (nk == NK_MULT)){
+        Poly lhs, rhs;
+
+        if(expand_poly(n->as.binop.lhs, &lhs) || expand_poly(n->as.binop.rhs, &rhs)){
+            return -1;
+        }
+
+        return (nk == NK_ADD) ? poly_add(&lhs, &rhs, p) : poly_mult(&lhs, &rhs, p);
+
+    } else if (nk == NK_FMA){
+        Poly a, b, c, product;
+
+        if(expand_poly(n->as.triple.first, &a) || expand_poly(n->as.triple.second, &b) || expand_poly(n->as.triple.third, &c)){
+            return -1;
+        }
+
+        return poly_mult(&a, &b, &product) || poly_add(&product, &c, p);
+
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/// @brief SURJECTIONS[m][k] = k! S(m, k), the number of ways to map m things onto k, filled by `init_poly`
+double SURJECTIONS[POLY_MAX_DEGREE + 1][POLY_MAX_DEGREE + 1];
+
+void init_poly(){
+    SURJECTIONS[0][0] = 1;
+
+    for(int m = 1; m <= POLY_MAX_DEGREE; ++m){
+        for(int k = 1; k <= m; ++k){
+            SURJECTIONS[m][k] = k * (SURJECTIONS[m - 1][k] + SURJECTIONS[m - 1][k - 1]);
+        }
+    }
+}
+
+/// @brief Evaluate `p` at `size` evenly spaced points along the scanline at `y`, starting at x = -1 with step 2 / `size`
+/// @param p
+/// @param y
+/// @param size
+/// @param out
+void poly_scanline(const Poly* p, float y, int size, float* out){
+    double row[POLY_MAX_DEGREE + 1]; // coefficients of the polynomial in x along this scanline
+    double diff[POLY_MAX_DEGREE + 1];
+    int d = p->degree_x;
+    double step = 2.0 / size;
+
+    for(int i = 0; i <= d; ++i){
+        row[i] = 0;
+
+        for(int j = p->degree_y; j >= 0; --j){
+            row[i] = row[i] * y + p->coef[i][j];
+        }
+    }
+
+    // shift to start at x = -1, row[i] becomes the coefficient of u^i with x = u - 1
+    for(int k = 0; k < d; ++k){
+        for(int i = d - 1; i >= k; --i){
+            row[i] -= row[i + 1];
+        }
+    }
+
+    // with u = step * t, the k-th forward difference at t = 0 is the sum over m of the t^m coefficient times k! S(m, k).
+    // Differencing sampled values instead would cancel catastrophically at high degrees
+    double scaled = 1;
+
+    for(int m = 0; m <= d; ++m){
+        row[m] *= scaled;
+        scaled *= step;
+    }
+
+    for(int k = 0; k <= d; ++k){
+        diff[k] = 0;
+
+        for(int m = k; m <= d; ++m){
+            diff[k] += row[m] * SURJECTIONS[m][k];
+        }
+    }
+
+    for(int x = 0; x < size; ++x){
+        out[x] = diff[0];
+
+        for(int k = 0; k < d; ++k){
+            diff[k] += diff[k + 1];
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "utils.h"
+
+/*
+    Fixed size thread pool shared by everything that runs in parallel. Jobs are queued in FIFO order and must only read
+    global state that doesn't change until `pool_wait` returns: the grammar, and node arrays that were snapshotted for them.
+    `ast` itself belongs to the main thread. Jobs can be counted in a separate group with `pool_submit_to`, so that they
+    aren't waited for by `pool_wait`.
+*/
+
+#define POOL_MAX_THREADS 64
+
+typedef void (*Job_func)(void* arg);
+
+typedef struct {
+    Job_func func;
+    void* arg;
+    size_t* pending; // counter of the group the job is in
+} Job;
+
+typedef struct {
+    pthread_t threads[POOL_MAX_THREADS];
+    int n_threads;
+
+    Job* queue; // ring buffer
+    size_t head;
+    size_t count;
+    size_t capacity;
+    size_t pending; // jobs submitted with `pool_submit`, queued or running
+
+    pthread_mutex_t lock;
+    pthread_cond_t has_job;
+    pthread_cond_t done;
+    int stop;
+} Pool;
+
+Pool pool;
+
+void* pool_worker(void* arg){
+    (void)arg;
+
+    pthread_mutex_lock(&pool.lock);
+
+    while(1){
+        while((pool.count == 0) && !pool.stop){
+            pthread_cond_wait(&pool.has_job, &pool.lock);
+        }
+
+        if(pool.stop){
+            break;
+        }
+
+        Job job = pool.queue[pool.head];
+        pool.head = (pool.head + 1) % pool.capacity;
+        pool.count--;
+
+        pthread_mutex_unlock(&pool.lock);
+        job.func(job.arg);
+        pthread_mutex_lock(&pool.lock);
+
+        if(--*job.pending == 0){
+            pthread_cond_broadcast(&pool.done);
+        }
+    }
+
+    pthread_mutex_unlock(&pool.lock);
+
+    return NULL;
+}
+
+/// @brief Start the pool, with one thread per online CPU. Does nothing if it is already running
+void init_pool(){
+    if(pool.n_threads){
+        return;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    pool.n_threads = (int)clamp(cpus, 1, POOL_MAX_THREADS);
+    pool.capacity = 64;
+    pool.queue = (Job*)malloc(sizeof(Job) * pool.capacity);
+    assert(pool.queue != NULL);
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.has_job, NULL);
+    pthread_cond_init(&pool.done, NULL);
+
+    for(int i = 0; i < pool.n_threads; ++i){
+        if(pthread_create(pool.threads + i, NULL, pool_worker, NULL) != 0){
+            printf("[ERROR] could not start pool thread %d\n", i);
+            exit(-1);
+        }
+    }
+}
+
+/// @brief Queue `func(arg)` to run on a pool thread, counting it in `*pending` until it has run
+/// @param pending
+/// @param func
+/// @param arg
+void pool_submit_to(size_t* pending, Job_func func, void* arg){
+    pthread_mutex_lock(&pool.lock);
+
+    if(pool.count == pool.capacity){
+        Job* queue = (Job*)malloc(sizeof(Job) * pool.capacity * 2);
+        assert(queue != NULL);
+
+        for(size_t i = 0; i < pool.count; ++i){
+            queue[i] = pool.queue[(pool.head + i) % pool.capacity];
+        }
+
+        free(pool.queue);
+        pool.queue = queue;
+        pool.head = 0;
+        pool.capacity *= 2;
+    }
+
+    pool.queue[(pool.head + pool.count) % pool.capacity] = (Job){func, arg, pending};
+    pool.count++;
+    (*pending)++;
+
+    pthread_cond_signal(&pool.has_job);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/// @brief Queue `func(arg)` to run on a pool thread
+/// @param func
+/// @param arg
+void pool_submit(Job_func func, void* arg){
+    pool_submit_to(&pool.pending, func, arg);
+}
+
+/// @brief Block until every job counted in `*pending` has finished
+void pool_wait_for(size_t* pending){
+    pthread_mutex_lock(&pool.lock);
+
+    while(*pending != 0){
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/// @brief Block until every job submitted with `pool_submit` has finished
+void pool_wait(){
+    pool_wait_for(&pool.pending);
+}
+
+void free_pool(){
+    if(!pool.n_threads){
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.has_job);
+    pthread_mutex_unlock(&pool.lock);
+
+    for(int i = 0; i < pool.n_threads; ++i){
+        pthread_join(pool.threads[i], NULL);
+    }
+
+    free(pool.queue);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.has_job);
+    pthread_cond_destroy(&pool.done);
+
+    pool = (Pool){0};
+}
+
+#endif
@@ -0,0 +1,310 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stdio.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "render.h"
+#include "cost.h"
+
+/*
+    Terminal preview. The first frame is sampled on a grid small enough to be rendered and drawn within `PREVIEW_FRAME_MS`,
+    going by the cost model scaled by how long earlier frames actually took. Each sample fills a block of the display, so
+    frames at every resolution take up the same space and are drawn over each other. Then, as long as no input arrives,
+    the resolution is doubled until it matches the terminal or the render budget.
+
+    Frames are drawn with truecolor half blocks, whose foreground and background colours are two pixels, or as sixel
+    images on terminals known to support them.
+*/
+
+#define PREVIEW_FRAME_MS 16.0
+#define PREVIEW_IDLE_MS 150 // refine once there has been no input for this long
+#define PREVIEW_PIXELS 256 // size of sixel images on terminals that don't report their size in pixels
+#define SIXEL_LEVELS 6 // sixel colours are quantized to a cube of this many levels per channel
+#define SIXEL_COLOURS (SIXEL_LEVELS * SIXEL_LEVELS * SIXEL_LEVELS)
+
+typedef enum {
+    PB_AUTO,
+    PB_BLOCKS,
+    PB_SIXEL
+} Preview_backend;
+
+const char* preview_backend_names[] = {"auto", "blocks", "sixel"};
+
+const char* sixel_terminals[] = {"mlterm", "yaft", "foot", "contour", "wezterm", "xterm-sixel"};
+
+Pixel preview_canvas[IMAGE_SIZE][IMAGE_SIZE];
+Text frame_text;
+
+Preview_backend preview_backend = PB_AUTO;
+float preview_correction = 1.0; // measured over predicted render time of earlier frames
+float draw_ns_per_pixel[3] = {0, 30.0, 60.0}; // per pixel of the display, measured by earlier frames
+int preview_lines = 0; // lines taken by the last frame, 0 once the prompt has been printed below it
+
+/// @brief The backend to draw with, picking sixel for `PB_AUTO` only if `TERM` names a terminal known to support it
+Preview_backend backend_in_use(){
+    if(preview_backend != PB_AUTO){
+        return preview_backend;
+    }
+
+    const char* term = getenv("TERM");
+
+    for(size_t i = 0; (term != NULL) && (i < sizeof(sixel_terminals) / sizeof(sixel_terminals[0])); ++i){
+        if(strstr(term, sixel_terminals[i]) != NULL){
+            return PB_SIXEL;
+        }
+    }
+
+    return PB_BLOCKS;
+}
+
+/// @brief Largest power of 2 no bigger than `n`, clamped to `TILE_SIZE` and `IMAGE_SIZE`
+int power_of_2_below(int n){
+    int p = TILE_SIZE;
+
+    while((p * 2 <= n) && (p * 2 <= IMAGE_SIZE)){
+        p *= 2;
+    }
+
+    return p;
+}
+
+/// @brief Size in pixels of the largest square display that fits in the terminal, below the line the frame ends with and the prompt
+int preview_fit(Preview_backend backend){
+    struct winsize w = {0};
+
+    if((ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) != 0) || (w.ws_col == 0) || (w.ws_row < 3)){
+        w = (struct winsize){.ws_row = 24, .ws_col = 80};
+    }
+
+    if(backend == PB_SIXEL){
+        if((w.ws_xpixel == 0) || (w.ws_ypixel == 0)){
+            return PREVIEW_PIXELS;
+        }
+
+        int cell_height = w.ws_ypixel / w.ws_row;
+        int height = w.ws_ypixel - 2 * cell_height;
+
+        return power_of_2_below((w.ws_xpixel < height) ? w.ws_xpixel : height);
+    }
+
+    // every character is two pixels high
+    int height = 2 * (w.ws_row - 2);
+
+    return power_of_2_below((w.ws_col < height) ? w.ws_col : height);
+}
+
+/// @brief Lines of the terminal a sixel image `display` pixels high takes up
+int sixel_lines(int display){
+    struct winsize w = {0};
+    int cell_height = 16;
+
+    if((ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0) && (w.ws_row != 0) && (w.ws_ypixel != 0)){
+        cell_height = w.ws_ypixel / w.ws_row;
+    }
+
+    return (display + cell_height - 1) / cell_height;
+}
+
+/// @brief Draw the top left `display` x `display` pixels of the preview canvas with half blocks, colours are only set when they change
+void encode_blocks(Text* t, int display){
+    for(int y = 0; y < display; y += 2){
+        Pixel fg = {0}, bg = {0};
+        int first = 1;
+
+        for(int x = 0; x < display; ++x){
+            Pixel top = preview_canvas[y][x], bottom = preview_canvas[y + 1][x];
+
+            if(first || memcmp(&top, &fg, 3)){
+                text_printf(t, "\x1b[38;2;%d;%d;%dm", (unsigned char)top.r, (unsigned char)top.g, (unsigned char)top.b);
+            }
+
+            if(first || memcmp(&bottom, &bg, 3)){
+                text_printf(t, "\x1b[48;2;%d;%d;%dm", (unsigned char)bottom.r, (unsigned char)bottom.g, (unsigned char)bottom.b);
+            }
+
+            fg = top;
+            bg = bottom;
+            first = 0;
+
+            text_printf(t, "▀");
+        }
+
+        text_printf(t, "\x1b[0m\n");
+    }
+}
+
+/// @brief Index of the colour in the sixel palette closest to `p`
+int sixel_colour(Pixel p){
+    int r = ((unsigned char)p.r * (SIXEL_LEVELS - 1) + 127) / 255;
+    int g = ((unsigned char)p.g * (SIXEL_LEVELS - 1) + 127) / 255;
+    int b = ((unsigned char)p.b * (SIXEL_LEVELS - 1) + 127) / 255;
+
+    return (r * SIXEL_LEVELS + g) * SIXEL_LEVELS + b;
+}
+
+/// @brief Draw the top left `display` x `display` pixels of the preview canvas as a sixel image. Each band of 6 rows is drawn once per
+/// @brief colour in it, with runs of the same sixel run length encoded
+void encode_sixel(Text* t, int display){
+    static unsigned char colour[6][IMAGE_SIZE];
+    int used[SIXEL_COLOURS];
+
+    text_printf(t, "\x1bPq\"1;1;%d;%d", display, display);
+
+    for(int i = 0; i < SIXEL_COLOURS; ++i){
+        int r = i / (SIXEL_LEVELS * SIXEL_LEVELS), g = (i / SIXEL_LEVELS) % SIXEL_LEVELS, b = i % SIXEL_LEVELS;
+
+        text_printf(t, "#%d;2;%d;%d;%d", i, r * 100 / (SIXEL_LEVELS - 1), g * 100 / (SIXEL_LEVELS - 1), b * 100 / (SIXEL_LEVELS - 1));
+    }
+
+    for(int y0 = 0; y0 < display; y0 += 6){
+        int rows = (display - y0 < 6) ? display - y0 : 6;
+
+        memset(used, 0, sizeof(used));
+
+        for(int k = 0; k < rows; ++k){
+            for(int x = 0; x < display; ++x){
+                colour[k][x] = sixel_colour(preview_canvas[y0 + k][x]);
+                used[colour[k][x]] = 1;
+            }
+        }
+
+        for(int i = 0; i < SIXEL_COLOURS; ++i){
+            if(!used[i]) continue;
+
+            text_printf(t, "#%d", i);
+
+            for(int x = 0; x < display;){
+                int bits = 0, run = 1;
+
+                for(int k = 0; k < rows; ++k){
+                    bits |= (colour[k][x] == i) << k;
+                }
+
+                for(; x + run < display; ++run){
+                    int next = 0;
+
+                    for(int k = 0; k < rows; ++k){
+                        next |= (colour[k][x + run] == i) << k;
+                    }
+
+                    if(next != bits) break;
+                }
+
+                if(run > 3){
+                    text_printf(t, "!%d%c", run, 63 + bits);
+                } else {
+                    for(int n = 0; n < run; ++n) text_char(t, 63 + bits);
+                }
+
+                x += run;
+            }
+
+            text_char(t, '$');
+        }
+
+        text_char(t, '-');
+    }
+
+    text_printf(t, "\x1b\\\n");
+}
+
+/// @brief 1 if the user has typed something within `wait_ms`. Input that isn't from a terminal never interrupts refinement
+int input_pending(int wait_ms){
+    if(!isatty(STDIN_FILENO)){
+        return 0;
+    }
+
+    struct pollfd p = {.fd = STDIN_FILENO, .events = POLLIN};
+
+    return poll(&p, 1, wait_ms) > 0;
+}
+
+/// @brief Render the AST on a `size` x `size` grid and draw it over the last frame, at `display` x `display` pixels. The cost model
+/// @brief correction and the drawing speed of `backend` are updated with how long this actually took
+/// @param cost
+/// @param size
+/// @param display
+/// @param backend
+/// @param normalize
+/// @return time taken in ms
+double preview_frame(Cost cost, int size, int display, Preview_backend backend, int normalize){
+    Render r = {.size = size, .scale = display / size, .canvas = preview_canvas, .normalize = normalize};
+
+    double start = now_ns();
+    render_canvas(&r, NULL);
+    double rendered = now_ns();
+
+    frame_text.used = 0;
+
+    if(preview_lines){
+        text_printf(&frame_text, "\x1b[%dA\r\x1b[J", preview_lines);
+    }
+
+    if(backend == PB_SIXEL){
+        encode_sixel(&frame_text, display);
+        preview_lines = sixel_lines(display) + 2; // the cursor is left on the line below the image, then moves down again
+    } else {
+        encode_blocks(&frame_text, display);
+        preview_lines = display / 2 + 1;
+    }
+
+    fwrite(frame_text.data, 1, frame_text.used, stdout);
+    fflush(stdout);
+
+    double end = now_ns();
+    double render_ms = (rendered - start) / 1e6, draw_ms = (end - rendered) / 1e6;
+
+    // average with earlier frames, so that one slow frame doesn't throw the next one off
+    preview_correction = 0.5 * preview_correction + 0.5 * render_ms / predicted_ms(cost, size);
+    draw_ns_per_pixel[backend] = 0.5 * draw_ns_per_pixel[backend] + 0.5 * draw_ms * 1e6 / ((double)display * display);
+
+    printf("preview %dx%d on %dx%d %s, %.1f ms (%.1f ms rendering)\n", size, size, display, display, preview_backend_names[backend], render_ms + draw_ms, render_ms);
+    fflush(stdout);
+
+    return render_ms + draw_ms;
+}
+
+/// @brief Preview the AST in the terminal within the frame time budget, then refine it until there is input or it is as sharp as the
+/// @brief terminal allows. Refinement stops at the size a full render would be degraded to
+/// @param cost
+/// @param normalize
+void preview(Cost cost, int normalize){
+    Preview_backend backend = backend_in_use();
+    int fit = preview_fit(backend);
+    int display = fit;
+    Render_plan plan = plan_render(cost);
+    int limit = plan.refuse ? TILE_SIZE : plan.size;
+
+    // drawing takes the same time whatever the grid, so it gets at most half the frame
+    while((display > TILE_SIZE) && (draw_ns_per_pixel[backend] * display * display / 1e6 > PREVIEW_FRAME_MS / 2)){
+        display /= 2;
+    }
+
+    double frame_ms = PREVIEW_FRAME_MS - draw_ns_per_pixel[backend] * display * display / 1e6;
+    int size = display;
+
+    while((size > TILE_SIZE) && (predicted_ms(cost, size) * preview_correction > frame_ms)){
+        size /= 2;
+    }
+
+    preview_lines = 0;
+    preview_frame(cost, size, display, backend, normalize);
+
+    while(((size < fit) && (size < limit)) && !input_pending(PREVIEW_IDLE_MS)){
+        size *= 2;
+        display = (display < size) ? size : display;
+
+        preview_frame(cost, size, display, backend, normalize);
+    }
+
+    printf("\n");
+}
+
+void free_preview(){
+    free(frame_text.data);
+    frame_text = (Text){0};
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <math.h>
+#include "ast.h"
+#include "range.h"
+
+/*
+    Output pixels only keep 8 bits per channel, so a channel doesn't need to be evaluated at full precision wherever its
+    error bound is smaller than the distance to the next quantization step. Bounds come from interval analysis over each
+    tile of the image: where a channel provably quantizes to a single level on a whole tile, that level is filled in without
+    evaluating anything, and everywhere else the tile falls back to float evaluation.
+*/
+
+#define TILE_SIZE 16
+#define QUANTIZE_LIMIT 1e6 // past this the level doesn't fit in an int
+
+/// @brief 8 bit level of the channel value `v`, as written to the output image
+char quantize(float v){
+    return (v+1)/2.0 * 255;
+}
+
+/// @brief Same as `quantize`, before the level is truncated to 8 bits. Monotonic in `v`
+int quantize_level(float v){
+    return (v+1)/2.0 * 255;
+}
+
+/// @brief Largest float at most `v`
+float float_below(double v){
+    float f = v;
+    return (f > v) ? nextafterf(f, -INFINITY) : f;
+}
+
+/// @brief Smallest float at least `v`
+float float_above(double v){
+    float f = v;
+    return (f < v) ? nextafterf(f, INFINITY) : f;
+}
+
+/// @brief Value quantizing to the same level as the channel at `index` everywhere on the tile spanning `x` and `y`, if there is one.
+/// @brief The negated channel must be constant too, since odd channels are mirrored with a sign flip, see `mirror_columns`
+/// @param index
+/// @param x
+/// @param y
+/// @param tolerance levels the channel may span and still be filled, with the middle of its range. 0 for exact renders
+/// @return NAN if the channel can't be proven to quantize to a single level (within `tolerance`) on the tile
+float tile_level_value(size_t index, Interval x, Interval y, int tolerance){
+    Interval r = node_range_over(index, x, y);
+
+    if(!is_finite(r) || (r.lo < -QUANTIZE_LIMIT) || (r.hi > QUANTIZE_LIMIT)){
+        return NAN;
+    }
+
+    float lo = float_below(r.lo);
+    float hi = float_above(r.hi);
+
+    if((quantize_level(hi) - quantize_level(lo) > tolerance) || (quantize_level(-lo) - quantize_level(-hi) > tolerance)){
+        return NAN;
+    }
+
+    return tolerance ? (lo + hi) / 2 : lo;
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include <math.h>
+#include "ast.h"
+
+/*
+    Interval analysis over the [-1, 1] square. Bounds are kept in double and are conservative: the value of a node at any
+    pixel lies within its interval. A node that may overflow or produce NaN gets [-inf, inf].
+*/
+
+#define RANGE_LIMIT 1e30 // beyond this a float result may overflow, treat it as unbounded
+#define RANGE_EPSILON 1e-20 // values this close to 0 may underflow to it in float
+
+typedef struct {
+    double lo;
+    double hi;
+} Interval;
+
+const Interval UNBOUNDED = {-INFINITY, INFINITY};
+
+/// @brief Interval of a computed value. It is widened slightly, since float results are rounded more coarsely than the double bounds
+Interval interval(double lo, double hi){
+    if(isnan(lo) || isnan(hi) || (fabs(lo) > RANGE_LIMIT) || (fabs(hi) > RANGE_LIMIT)){
+        return UNBOUNDED;
+    }
+
+    double slack = 1e-6 * fmax(fabs(lo), fabs(hi));
+
+    return (Interval){lo - slack, hi + slack};
+}
+
+int is_finite(Interval i){
+    return isfinite(i.lo) && isfinite(i.hi);
+}
+
+int excludes_zero(Interval i){
+    return (i.lo > RANGE_EPSILON) || (i.hi < -RANGE_EPSILON);
+}
+
+int is_constant_range(Interval i, double value){
+    return (i.lo == value) && (i.hi == value);
+}
+
+Interval range_mult(Interval a, Interval b){
+    if(!is_finite(a) || !is_finite(b)){
+        return UNBOUNDED;
+    }
+
+    double p[4] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+
+    return interval(fmin(fmin(p[0], p[1]), fmin(p[2], p[3])), fmax(fmax(p[0], p[1]), fmax(p[2], p[3])));
+}
+
+/// @brief Range of a 2 pi periodic function with a maximum of 1 at `peak` and a minimum of -1 half a period later, like sin and cos
+/// @param a
+/// @param f
+/// @param peak
+/// @return
+Interval range_periodic(Interval a, double (*f)(double), double peak){
+    if(!is_finite(a)){
+        return UNBOUNDED;
+    } else if (a.hi - a.lo >= 2 * M_PI){
+        return (Interval){-1, 1};
+    }
+
+    double lo = fmin(f(a.lo), f(a.hi));
+    double hi = fmax(f(a.lo), f(a.hi));
+
+    // first maximum and minimum at or after the start of the interval
+    double max_at = peak + 2 * M_PI * ceil((a.lo - peak) / (2 * M_PI));
+    double min_at = peak + M_PI + 2 * M_PI * ceil((a.lo - peak - M_PI) / (2 * M_PI));
+
+    if(max_at <= a.hi) hi = 1;
+    if(min_at <= a.hi) lo = -1;
+
+    return interval(lo, hi);
+}
+
+/// @brief Range of `nk` applied to operands in `a` and `b`. Unary operators only use `a`
+/// @param nk
+/// @param a
+/// @param b
+/// @return
+Interval range_of_op(Node_kind nk, Interval a, Interval b){
+
+    switch(nk){
+        case NK_X:
+        case NK_Y:
+            return (Interval){-1, 1};
+
+        case NK_SIN:
+            return range_periodic(a, sin, M_PI / 2);
+
+        case NK_COS:
+            return range_periodic(a, cos, 0);
+
+        case NK_EXP:
+            return is_finite(a) ? interval(exp(a.lo), exp(a.hi)) : UNBOUNDED;
+
+        case NK_ADD:
+            return is_finite(a) && is_finite(b) ? interval(a.lo + b.lo, a.hi + b.hi) : UNBOUNDED;
+
+        case NK_MULT:
+            return range_mult(a, b);
+
+        case NK_GEQ:
+            if(a.lo >= b.hi){
+                return (Interval){1, 1};
+            } else if (a.hi < b.lo){
+                return (Interval){0, 0};
+            } else {
+                return (Interval){0, 1};
+            }
+
+        case NK_DIV:
+            // a divisor of exactly 0 is replaced by 1, anything that gets close to 0 is unbounded
+            if(is_constant_range(b, 0)){
+                return a;
+            } else if (!excludes_zero(b)){
+                return UNBOUNDED;
+            } else {
+                return range_mult(a, (Interval){1.0 / b.hi, 1.0 / b.lo});
+            }
+
+        case NK_MOD: {
+            if(!is_finite(a) || !is_finite(b)){
+                return UNBOUNDED;
+            }
+
+            // fmod keeps the sign of the dividend and is smaller than the divisor in magnitude
+            double m = fmax(fmax(fabs(b.lo), fabs(b.hi)), excludes_zero(b) ? 0 : 1);
+            double lo = (a.lo >= 0) ? 0 : fmax(a.lo, -m);
+            double hi = (a.hi <= 0) ? 0 : fmin(a.hi, m);
+
+            return (Interval){lo, hi};
+        }
+
+        case NK_NUMBER:
+        case NK_FMA:
+        case NK_AFFINE_X:
+        case NK_AFFINE_Y:
+        case NK_E:
+        case NK_IF_THEN_ELSE:
+        default:
+            return UNBOUNDED;
+    }
+}
+
+/// @brief Conservative range of the channel subtree at `index` for x in `x` and y in `y`
+/// @param index
+/// @param x
+/// @param y
+/// @return
+Interval node_range_over(size_t index, Interval x, Interval y){
+    Node* n = ast.array + index;
+    Node_kind nk = node_kind(n);
+
+    if(nk == NK_NUMBER){
+        return (Interval){n->as.number, n->as.number};
+
+    } else if ((nk == NK_X) || (nk == NK_Y)){
+        return (nk == NK_X) ? x : y;
+
+    } else if (nk & NK_UNOP){
+        return range_of_op(nk, node_range_over(n->as.unop, x, y), UNBOUNDED);
+
+    } else if (nk & NK_BINOP){
+        return range_of_op(nk, node_range_over(n->as.binop.lhs, x, y), node_range_over(n->as.binop.rhs, x, y));
+
+    } else if (nk == NK_FMA){
+        Interval product = range_mult(node_range_over(n->as.triple.first, x, y), node_range_over(n->as.triple.second, x, y));
+
+        return range_of_op(NK_ADD, product, node_range_over(n->as.triple.third, x, y));
+
+    } else if (nk & NK_AFFINE){
+        Interval scale = {n->as.affine.scale, n->as.affine.scale};
+        Interval offset = {n->as.affine.offset, n->as.affine.offset};
+
+        return range_of_op(NK_ADD, range_mult(scale, (nk == NK_AFFINE_X) ? x : y), offset);
+
+    } else {
+        return range_of_op(nk, UNBOUNDED, UNBOUNDED);
+    }
+}
+
+/// @brief Conservative range of the channel subtree at `index` over the [-1, 1] square
+/// @param index
+/// @return
+Interval node_range(size_t index){
+    return node_range_over(index, (Interval){-1, 1}, (Interval){-1, 1});
+}
+
+#endif
@@ -5,6 +5,16 @@
 #include "stb_image_write.h"
 #include <math.h>
 #include "interpreter.h"
+#include "poly.h"
+#include "symmetry.h"
+#include "quantize.h"
+#include "stats.h"
+#include "pool.h"
+#include "scheduler.h"
+#include "buffers.h"
+#include "cache.h"
+#include "planes.h"
+#include "journal.h"
 
 #define IMAGE_SIZE 512
 
@@ -15,40 +25,590 @@ typedef struct {
     char a;
 } Pixel;
 
-int render_image(){
-    float f_x, f_y;
-    Pixel canvas[IMAGE_SIZE][IMAGE_SIZE];
+/// @brief Evaluate the AST at every pixel of scanline `int_y` up to column `last`, one row per channel
+/// @param nodes
+/// @param ps subtree planes to read, or NULL
+/// @param root
+/// @param int_y
+/// @param size
+/// @param last
+/// @param fast see `EVAL_NUMBER_NODE`
+/// @param row
+void eval_scanline(const Node* nodes, const Plane_set* ps, uint32_t root, int int_y, int size, int last, int fast, float* row[3]){
+    float rgb[3];
+    float f_y = ((float)int_y / (float)size) * 2.0 - 1.0;
+
+    for(int int_x = 0; int_x <= last; ++int_x){
+        // map pixel coordinates to [-1, 1]
+        float f_x = ((float)int_x / (float)size) * 2.0 - 1.0;
+
+        if(ps == NULL){
+            eval_rgb(nodes, root, f_x, f_y, fast, rgb);
+        } else {
+            eval_rgb_planes(nodes, ps, root, f_x, f_y, (size_t)int_y * size + int_x, rgb);
+        }
+
+        row[0][int_x] = rgb[0];
+        row[1][int_x] = rgb[1];
+        row[2][int_x] = rgb[2];
+    }
+}
+
+/// @brief Everything needed to render one row of the image, shared read-only by the pool threads rendering it
+typedef struct {
+    const Node* nodes; // `ast.array`, or a snapshot of it for renders that run in the background
+    int size;
+    int scale;
+    uint32_t root_index;
+    int split; // channels of an E root can be evaluated separately
+    uint32_t channels[3];
+    Poly poly[3];
+    int is_poly[3];
+
+    Parity parity_x[3];
+    Parity parity_y[3];
+    int mirror_x; // for an if-then-else root, whose channels are evaluated together, so can only be mirrored together
+    int mirror_y;
+
+    int tiles;
+    int filled; // channel tiles filled without evaluating them
+    int tile_tolerance; // levels a filled tile may span, see `tile_level_value`
+    int fast_math; // evaluate with cheaper sin, cos and exp, see `EVAL_NUMBER_NODE`
+    float* tile_fill; // value to fill each tile of each channel with, NAN where the tile has to be evaluated
+    float* planes; // one plane of samples per channel, mirrored rows are copied from earlier ones
+    int keep_planes; // read and fill planes of subtrees, see planes.h
+    Plane_set* subtree_planes;
+    int planes_reused;
+    int planes_filled;
+    Pixel (*canvas)[IMAGE_SIZE]; // allocated when the render starts if NULL, and freed by `finish_render`
+    int owns_canvas;
+
+    int slots; // accumulators below, one per unit of the phase with the most, see `unit_slots`
+    Render_stats* slot_stats; // NULL if stats aren't wanted
+
+    int normalize; // remap each channel's actual range to 0-255, rather than [-1, 1]
+    float (*slot_range)[3][2]; // min and max of the finite samples of each channel, one per slot
+    float range[3][2];
+
+    double deadline_ns; // abandon the render once it is projected to finish after this, 0 for no deadline
+    double start_ns;
+    int rows_total; // rows that are evaluated rather than mirrored
+    int rows_done;
+    int abandoned;
+} Render;
+
+#define RENDER_BAND_ROWS 8 // rows rendered by each unit of a render job
+
+/// @brief Sample row `int_y` of every channel into the planes. Rows mirrored along y must come after the rows they mirror
+void render_row(Render* r, int int_y){
+    int size = r->size;
+    int tiles = r->tiles;
+
+    // map pixel coordinates to [-1, 1]
+    float f_y = ((float)int_y / (float)size) * 2.0 - 1.0;
+    float* row[3];
+
+    for(int c = 0; c < 3; ++c){
+        row[c] = r->planes + ((size_t)c * size + int_y) * size;
+    }
+
+    if(!r->split){
+        if((int_y > size / 2) && r->mirror_y){
+            for(int c = 0; c < 3; ++c){
+                mirror_row(row[c], r->planes + ((size_t)c * size + size - int_y) * size, size, r->parity_y[c]);
+            }
+            return;
+        }
+
+        eval_scanline(r->nodes, r->subtree_planes, r->root_index, int_y, size, r->mirror_x ? size / 2 : size - 1, r->fast_math, row);
+
+        for(int c = 0; r->mirror_x && (c < 3); ++c){
+            mirror_columns(row[c], size, r->parity_x[c]);
+        }
+
+        return;
+    }
+
+    for(int c = 0; c < 3; ++c){
+
+        if(r->is_poly[c]){
+            poly_scanline(r->poly + c, f_y, size, row[c]);
+            continue;
+        }
+
+        if((int_y > size / 2) && (r->parity_y[c] != PAR_NONE)){
+            mirror_row(row[c], r->planes + ((size_t)c * size + size - int_y) * size, size, r->parity_y[c]);
+            continue;
+        }
+
+        int last = (r->parity_x[c] != PAR_NONE) ? size / 2 : size - 1;
+        float* fill = r->tile_fill + (c * tiles + int_y / TILE_SIZE) * tiles;
+
+        for(int int_x = 0; int_x <= last; ++int_x){
+            float f_x = ((float)int_x / (float)size) * 2.0 - 1.0;
+            float v = fill[int_x / TILE_SIZE];
+
+            if(isnan(v)){
+                v = (r->subtree_planes == NULL) ? eval_number(r->nodes, r->channels[c], f_x, f_y, r->fast_math)
+                    : eval_planes(r->nodes, r->subtree_planes, r->channels[c], f_x, f_y, (size_t)int_y * size + int_x);
+            }
+
+            row[c][int_x] = v;
+        }
+
+        if(r->parity_x[c] != PAR_NONE){
+            mirror_columns(row[c], size, r->parity_x[c]);
+        }
+    }
+}
+
+/// @brief Widen the channel ranges of `slot` to cover row `int_y` of the planes
+void measure_row(Render* r, int int_y, int slot){
+    float (*range)[2] = r->slot_range[slot];
+
+    for(int c = 0; c < 3; ++c){
+        const float* row = r->planes + ((size_t)c * r->size + int_y) * r->size;
+
+        for(int int_x = 0; int_x < r->size; ++int_x){
+            if(!isfinite(row[int_x])) continue;
+
+            range[c][0] = fminf(range[c][0], row[int_x]);
+            range[c][1] = fmaxf(range[c][1], row[int_x]);
+        }
+    }
+}
+
+/// @brief 8 bit level of the sample `v` of channel `c`, remapped from the channel's range when normalizing
+char quantize_sample(Render* r, int c, float v){
+    float lo = r->range[c][0], hi = r->range[c][1];
+
+    if(!r->normalize || !(hi > lo)){
+        return quantize(v);
+    }
+
+    // infinities from overflow clip to the ends, NaN goes to 0
+    float level = (v - lo) / (hi - lo) * 255;
+
+    return (unsigned char)((level >= 255) ? 255 : (level > 0) ? level : 0);
+}
+
+/// @brief Quantize row `int_y` of the planes into its block of the canvas, accumulating stats in `slot` if they are wanted
+void write_row(Render* r, int int_y, int slot){
+    int size = r->size;
+    int scale = r->scale;
+    const float* row[3];
+
+    for(int c = 0; c < 3; ++c){
+        row[c] = r->planes + ((size_t)c * size + int_y) * size;
+    }
+
+    Render_stats* stats = (r->slot_stats == NULL) ? NULL : r->slot_stats + slot;
+
+    for(int int_x = 0; int_x < size; ++int_x){
+        Pixel p = {
+            .r = quantize_sample(r, 0, row[0][int_x]),
+            .g = quantize_sample(r, 1, row[1][int_x]),
+            .b = quantize_sample(r, 2, row[2][int_x]),
+            .a = 255
+        };
+
+        if(stats != NULL){
+            accumulate_stats(stats, p.r, p.g, p.b);
+        }
+
+        for(int j = 0; j < scale; ++j){
+            for(int i = 0; i < scale; ++i){
+                r->canvas[int_y * scale + j][int_x * scale + i] = p;
+            }
+        }
+    }
+}
+
+/// @brief 1 if the render has a deadline that it will miss, going by how long the rows done so far took. Once a render is abandoned
+/// @brief the rest of its rows are skipped
+int render_abandoned(Render* r){
+    if(r->deadline_ns == 0){
+        return 0;
+    }
+
+    if(__atomic_load_n(&r->abandoned, __ATOMIC_RELAXED)){
+        return 1;
+    }
+
+    int done = __atomic_load_n(&r->rows_done, __ATOMIC_RELAXED);
+    double now = now_ns();
 
-    for(int int_y = 0; int_y < IMAGE_SIZE; ++int_y){
-        for(int int_x = 0; int_x < IMAGE_SIZE; ++int_x){
-            // map pixel coordinates to [-1, 1]
-            f_x = ((float)int_x / (float)IMAGE_SIZE) * 2.0 - 1.0;
-            f_y = ((float)int_y / (float)IMAGE_SIZE) * 2.0 - 1.0;
+    // the first few rows say little about the rest
+    double projected = (done < RENDER_BAND_ROWS) ? now : r->start_ns + (now - r->start_ns) * r->rows_total / done;
 
-            Node* res = ast.array + eval(f_x, f_y); // sample function built from AST
+    if(projected > r->deadline_ns){
+        __atomic_store_n(&r->abandoned, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    return 0;
+}
+
+/// @brief Row bands rendered by each phase of a render job: 0 renders the top half and the middle row, 1 the rest, which may be mirrored
+/// @brief from rows of phase 0, and 2 writes normalized rows once the range of every channel is known
+void phase_rows(Render* r, int phase, int* first, int* last){
+    *first = (phase == 1) ? r->size / 2 + 1 : 0;
+    *last = (phase == 0) ? r->size / 2 : r->size - 1;
+}
+
+int count_bands(Render* r, int phase){
+    int first, last;
+    phase_rows(r, phase, &first, &last);
+
+    return (last - first) / RENDER_BAND_ROWS + 1;
+}
+
+/// @brief Accumulators a render needs, one per unit of its largest phase. Units of a phase each have their own, and phases never overlap,
+/// @brief so every accumulator is only ever written by one thread at a time, whichever thread that is: a pool thread, the main thread or a
+/// @brief thread outside the pool running a render on its own
+int unit_slots(Render* r){
+    return r->size / RENDER_BAND_ROWS + 1;
+}
+
+/// @brief Merge the per slot channel ranges of a normalized render
+void merge_ranges(Render* r){
+    for(int c = 0; c < 3; ++c){
+        r->range[c][0] = INFINITY;
+        r->range[c][1] = -INFINITY;
+
+        for(int t = 0; t < r->slots; ++t){
+            r->range[c][0] = fminf(r->range[c][0], r->slot_range[t][c][0]);
+            r->range[c][1] = fmaxf(r->range[c][1], r->slot_range[t][c][1]);
+        }
+    }
+}
 
-            if(res == NULL){
-                printf("[%s] AST is invalid! Cannot evaluate it\n", __FILE__);
-                return -1;
+/// @brief `Phase_func` of render jobs. The sample planes, and the canvas if there is none, are only allocated once the job starts
+int render_next_phase(void* ctx, int phase){
+    Render* r = (Render*)ctx;
+
+    switch(phase){
+        case -1:
+            r->start_ns = now_ns();
+            r->planes = acquire_buffer(3 * r->size * r->size);
+
+            if(r->canvas == NULL){
+                r->canvas = (Pixel (*)[IMAGE_SIZE])malloc(sizeof(Pixel) * IMAGE_SIZE * IMAGE_SIZE);
+                assert(r->canvas != NULL);
+                r->owns_canvas = 1;
             }
 
-            if(res->nk != NK_E){
-                printf("[FILE %s] Final output from AST must be E! AST head added at line %d does not evaluate to that\n", res->file, res->line);
-                return -1;
+            return count_bands(r, 0);
+
+        case 0:
+            return (r->size / 2 + 1 < r->size) ? count_bands(r, 1) : 0;
+
+        case 1:
+            if(!r->normalize || r->abandoned){
+                return 0;
             }
 
-            float first = ast.array[res->as.triple.first].as.number;
-            float second = ast.array[res->as.triple.second].as.number;
-            float third = ast.array[res->as.triple.third].as.number;
+            merge_ranges(r);
+            return count_bands(r, 2);
+
+        default:
+            return 0;
+    }
+}
+
+/// @brief `Unit_func` of render jobs, renders or writes one band of rows
+void render_unit(void* ctx, int phase, int unit){
+    Render* r = (Render*)ctx;
+    int first, last;
+
+    phase_rows(r, phase, &first, &last);
+    first += unit * RENDER_BAND_ROWS;
+    last = (first + RENDER_BAND_ROWS - 1 < last) ? first + RENDER_BAND_ROWS - 1 : last;
 
-            canvas[int_y][int_x].r = (first+1)/2.0 * 255;
-            canvas[int_y][int_x].g = (second+1)/2.0 * 255;
-            canvas[int_y][int_x].b = (third+1)/2.0 * 255;
-            canvas[int_y][int_x].a = 255;
+    for(int int_y = first; (int_y <= last) && !render_abandoned(r); ++int_y){
+        if(phase == 2){
+            write_row(r, int_y, unit);
+            continue;
         }
+
+        if(r->subtree_planes != NULL){
+            fill_planes_row(r->nodes, r->subtree_planes, int_y);
+        }
+
+        render_row(r, int_y);
+
+        if((int_y <= r->size / 2) || !r->mirror_y){
+            __atomic_add_fetch(&r->rows_done, 1, __ATOMIC_RELAXED);
+        }
+
+        // when normalizing, rows are written once the range of every channel is known
+        if(r->normalize){
+            measure_row(r, int_y, unit);
+        } else {
+            write_row(r, int_y, unit);
+        }
+    }
+}
+
+/// @brief `Done_func` of render jobs that are waited for
+void render_done(void* ctx, int cancelled){
+    Render* r = (Render*)ctx;
+
+    r->abandoned |= cancelled;
+}
+
+/// @brief Work out how to render the AST held in `ast` on the grid `r->size`, everything that needs `ast` itself. The AST must have passed
+/// @brief `check_ast`, nothing is checked per pixel
+/// @param r
+/// @param want_stats
+void prepare_render(Render* r, int want_stats){
+    int size = r->size;
+
+    if(r->nodes == NULL){
+        r->nodes = ast.array;
+    }
+
+    r->root_index = ast.size - 1;
+    const Node* root = ast.array + r->root_index;
+
+    assert((size >= TILE_SIZE) && (size * r->scale <= IMAGE_SIZE));
+    init_pool();
+
+    r->rows_done = 0;
+    r->abandoned = 0;
+
+    root_parity(r->root_index, NK_X, r->parity_x);
+    root_parity(r->root_index, NK_Y, r->parity_y);
+
+    r->split = node_kind(root) == NK_E;
+
+    if(r->split){
+        r->channels[0] = root->as.triple.first;
+        r->channels[1] = root->as.triple.second;
+        r->channels[2] = root->as.triple.third;
+
+        for(int c = 0; c < 3; ++c){
+            r->is_poly[c] = !expand_poly(r->channels[c], r->poly + c);
+        }
+    }
+
+    if(r->keep_planes){
+        int skip[3] = {r->split && r->is_poly[0], r->split && r->is_poly[1], r->split && r->is_poly[2]};
+
+        r->subtree_planes = attach_planes(size, skip, r->fast_math);
+        r->planes_reused = (r->subtree_planes == NULL) ? 0 : r->subtree_planes->n_reused;
+        r->planes_filled = (r->subtree_planes == NULL) ? 0 : r->subtree_planes->n_fill;
+    }
+
+    r->mirror_x = r->mirror_y = 1;
+
+    for(int c = 0; c < 3; ++c){
+        r->mirror_x &= r->parity_x[c] != PAR_NONE;
+        r->mirror_y &= r->parity_y[c] != PAR_NONE;
+    }
+
+    r->rows_total = r->mirror_y ? size / 2 + 1 : size;
+
+    r->filled = 0;
+    r->tiles = size / TILE_SIZE;
+    r->tile_fill = (float*)malloc(sizeof(float) * 3 * r->tiles * r->tiles);
+    assert(r->tile_fill != NULL);
+
+    for(int c = 0; c < 3; ++c){
+        for(int t = 0; t < r->tiles * r->tiles; ++t){
+            r->tile_fill[c * r->tiles * r->tiles + t] = NAN;
+
+            // filled tiles only hold a value with the right level, their range is unknown
+            if(!r->split || r->is_poly[c] || r->normalize) continue;
+
+            int x0 = (t % r->tiles) * TILE_SIZE, y0 = (t / r->tiles) * TILE_SIZE;
+            Interval x = {((float)x0 / size) * 2.0 - 1.0, ((float)(x0 + TILE_SIZE - 1) / size) * 2.0 - 1.0};
+            Interval y = {((float)y0 / size) * 2.0 - 1.0, ((float)(y0 + TILE_SIZE - 1) / size) * 2.0 - 1.0};
+
+            r->tile_fill[c * r->tiles * r->tiles + t] = tile_level_value(r->channels[c], x, y, r->tile_tolerance);
+            r->filled += !isnan(r->tile_fill[c * r->tiles * r->tiles + t]);
+        }
+    }
+
+    r->slots = unit_slots(r);
+
+    if(want_stats){
+        r->slot_stats = (Render_stats*)calloc(r->slots, sizeof(Render_stats));
+        assert(r->slot_stats != NULL);
+    }
+
+    if(r->normalize){
+        r->slot_range = (float (*)[3][2])malloc(sizeof(float[3][2]) * r->slots);
+        assert(r->slot_range != NULL);
+
+        for(int t = 0; t < r->slots; ++t){
+            for(int c = 0; c < 3; ++c){
+                r->slot_range[t][c][0] = INFINITY;
+                r->slot_range[t][c][1] = -INFINITY;
+            }
+        }
+    }
+}
+
+/// @brief Collect the stats of a render job that has ended, and free everything but the canvas
+/// @param r
+/// @param stats if not NULL, filled with statistics of the canvas, as they would be read back from an image of it
+void finish_render(Render* r, Render_stats* stats){
+    if(stats != NULL){
+        *stats = (Render_stats){0};
+
+        for(int t = 0; t < r->slots; ++t){
+            merge_stats(stats, r->slot_stats + t);
+        }
+
+        // every sample fills a scale x scale block of the image
+        scale_stats(stats, r->scale * r->scale);
+        finish_stats(stats);
+    }
+
+    free(r->slot_stats);
+    free(r->slot_range);
+    free(r->tile_fill);
+    release_buffer(r->planes);
+
+    if(r->subtree_planes != NULL){
+        detach_planes(r->subtree_planes, r->nodes, r->root_index + 1, !r->abandoned);
+    }
+
+    r->slot_stats = NULL;
+    r->slot_range = NULL;
+    r->tile_fill = NULL;
+    r->planes = NULL;
+    r->subtree_planes = NULL;
+}
+
+/// @brief Render the AST into `r->canvas`, as an interactive job of the scheduler, and wait for it. The AST is sampled on an `r->size` x
+/// @brief `r->size` grid, and each sample fills an `r->scale` x `r->scale` block of the canvas, which must be set up by the caller along
+/// @brief with `r->normalize`. Rows are rendered in bands, see `render_unit`. Channels of an E root that are polynomials are evaluated with
+/// @brief forward differences along each scanline, see `poly_scanline`. Channels that are even or odd in x or y are only evaluated on half
+/// @brief (or a quarter) of the grid and mirrored, see `root_parity`. Tiles on which a channel provably quantizes to a single level are
+/// @brief filled without evaluating it, see `tile_level_value`. With a deadline, rendering stops as soon as it is projected to miss it,
+/// @brief leaving the canvas partly written
+/// @param r `size` must be a power of 2 no smaller than `TILE_SIZE`, with `size * scale` no bigger than `IMAGE_SIZE`. When normalizing, each
+/// @param r channel is remapped from the range it actually covers to 0-255, which is left in `r->range`. The samples are kept in their planes
+/// @param r until the range is known, so this only costs one more pass over them
+/// @param stats if not NULL, filled with statistics of the canvas, as they would be read back from an image of it
+/// @return 0, or -1 if the render was abandoned
+int render_canvas(Render* r, Render_stats* stats){
+    char name[64];
+
+    prepare_render(r, stats != NULL);
+
+    snprintf(name, sizeof(name), "render %dx%d", r->size, r->size);
+    sched_wait(sched_submit(PRIO_INTERACTIVE, name, r, render_next_phase, render_unit, render_done));
+
+    finish_render(r, stats);
+
+    return r->abandoned ? -1 : 0;
+}
+
+typedef struct {
+    Render r;
+    Node* nodes; // snapshot of the AST
+    char path[64];
+    char cache_as[CACHE_NAME_SIZE]; // empty if not cached
+    Journal* journal; // NULL if not journaled
+    U64 seed;
+} Batch_render;
+
+void batch_render_done(void* ctx, int cancelled){
+    Batch_render* b = (Batch_render*)ctx;
+
+    char tmp[80];
+    struct stat st;
+
+    finish_render(&b->r, NULL);
+
+    // renamed into place once whole, so that a png under its own name is never cut short
+    snprintf(tmp, sizeof(tmp), "%s.tmp", b->path);
+
+    if(cancelled){
+        // nothing to write
+
+    } else if(!stbi_write_png(tmp, IMAGE_SIZE, IMAGE_SIZE, 4, *b->r.canvas, sizeof(Pixel) * IMAGE_SIZE) || (rename(tmp, b->path) != 0)){
+        printf("[ERROR] could not write %s\n", b->path);
+        unlink(tmp);
+
+    } else {
+        if(b->cache_as[0]){
+            cache_store(b->cache_as, b->path);
+        }
+
+        if((b->journal != NULL) && (stat(b->path, &st) == 0)){
+            journal_done(b->journal, b->seed, st.st_size);
+        }
+    }
+
+    journal_release(b->journal);
+
+    if(b->r.owns_canvas){
+        free(b->r.canvas);
+    }
+
+    free(b->nodes);
+    free(b);
+}
+
+/// @brief Queue a batch job rendering the AST held in `ast` to a png at `path`, in the background
+/// @param size as for `render_image`
+/// @param path
+/// @param cache_as name to store the png under in the render cache, or NULL
+/// @param journal the png is recorded in it as `seed` once written, NULL for none
+/// @param seed
+/// @return id of the job
+int submit_batch_render(int size, const char* path, const char* cache_as, Journal* journal, U64 seed){
+    Batch_render* b = (Batch_render*)calloc(1, sizeof(Batch_render));
+    assert(b != NULL);
+
+    b->nodes = (Node*)malloc(sizeof(Node) * ast.size);
+    assert(b->nodes != NULL);
+    memcpy(b->nodes, ast.array, sizeof(Node) * ast.size);
+
+    b->r = (Render){.nodes = b->nodes, .size = size, .scale = IMAGE_SIZE / size};
+    snprintf(b->path, sizeof(b->path), "%s", path);
+    snprintf(b->cache_as, sizeof(b->cache_as), "%s", (cache_as == NULL) ? "" : cache_as);
+    b->journal = journal;
+    b->seed = seed;
+    journal_retain(journal);
+
+    prepare_render(&b->r, 0);
+
+    return sched_submit(PRIO_BATCH, b->path, b, render_next_phase, render_unit, batch_render_done);
+}
+
+/// @brief Render the AST to a png at `path`, see `render_canvas`
+/// @param size must be a power of 2 dividing `IMAGE_SIZE`, pass `IMAGE_SIZE` for a full resolution render
+/// @param path
+/// @param stats if not NULL, filled with statistics of the image, as they would be read back from the png. Tiles filled without evaluating
+/// @param stats them and subtree planes read or filled are only reported with statistics on
+/// @param normalize remap each channel from the range it actually covers to 0-255
+/// @param keep_planes reuse the samples of subtrees that earlier renders kept, and keep some of this one's, see planes.h
+/// @return
+int render_image(int size, const char* path, Render_stats* stats, int normalize, int keep_planes){
+    Pixel canvas[IMAGE_SIZE][IMAGE_SIZE];
+    Render r = {.size = size, .scale = IMAGE_SIZE / size, .canvas = canvas, .normalize = normalize, .keep_planes = keep_planes};
+
+    assert(IMAGE_SIZE % size == 0);
+    render_canvas(&r, stats);
+
+    if((stats != NULL) && (r.planes_reused || r.planes_filled)){
+        printf("Read %d subtrees from cached planes, filled planes of %d more\n", r.planes_reused, r.planes_filled);
+    }
+
+    if((stats != NULL) && r.filled){
+        printf("Filled %d of %d channel tiles without evaluating them\n", r.filled, 3 * r.tiles * r.tiles);
+    }
+
+    for(int c = 0; normalize && (c < 3); ++c){
+        printf("%s normalized from [%g, %g]\n", channel_names[c], r.range[c][0], r.range[c][1]);
     }
 
-    if(!stbi_write_png("randomart.png", IMAGE_SIZE, IMAGE_SIZE, 4, *canvas, sizeof(Pixel) * IMAGE_SIZE)){
+    if(!stbi_write_png(path, IMAGE_SIZE, IMAGE_SIZE, 4, *canvas, sizeof(Pixel) * IMAGE_SIZE)){
         printf("[ERROR] could not write image\n");
         return -1;
     }
@@ -57,4 +617,4 @@ int render_image(){
 }
 
 
-#endif
\ No newline at end of file
+#endif
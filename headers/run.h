@@ -6,11 +6,25 @@
 #include "parser.h"
 #include "render.h"
 #include "interpreter.h"
+#include "cost.h"
+#include "serialize.h"
+#include "simplify.h"
+#include "peephole.h"
+#include "check.h"
+#include "search.h"
+#include "explore.h"
+#include "preview.h"
+#include "deadline.h"
+#include "server.h"
+#include "distrib.h"
+#include "dataset.h"
+#include "pipeline.h"
 
 void init(){
 
     grammar();
     print_grammar();
+    init_poly();
     init_ast(20);
 }
 
@@ -18,6 +32,9 @@ void run(){
     U64 seed; 
     int depth = 0;
     int seed_set = 0;
+    int show_stats = 0;
+    int normalize = 0;
+    double deadline_ms = 0;
     Run_mode mode;
 
     init();
@@ -32,6 +49,8 @@ void run(){
 
         reset_ast();
 
+        int packed = 0; // binary ASTs were simplified before they were saved
+
         if (!strncmp(command, "quit", 4)){
             break;
         } else if(!strncmp(command, "depth", 5)){
@@ -47,6 +66,307 @@ void run(){
         } else if (!strncmp(command, "render", 6)){
             mode = RM_RENDER;
             continue;
+        } else if (!strncmp(command, "preview", 7)){
+            mode = RM_PREVIEW;
+
+            for(int b = 0; b < 3; ++b){
+                if(!strcmp(command + 7 + (command[7] == ' '), preview_backend_names[b])){
+                    preview_backend = (Preview_backend)b;
+                }
+            }
+
+            printf("Previewing in the terminal with %s\n\n", preview_backend_names[backend_in_use()]);
+            continue;
+        } else if (!strncmp(command, "deadline", 8)){
+            deadline_ms = fmax(0, strtod(command + 8, &end));
+
+            if(deadline_ms > 0){
+                printf("Rendering within %.0f ms\n\n", deadline_ms);
+            } else {
+                printf("Rendering without a deadline\n\n");
+            }
+
+            continue;
+        } else if (!strncmp(command, "stats", 5)){
+            show_stats = !show_stats;
+            printf("Image statistics %s\n\n", show_stats ? "on" : "off");
+            continue;
+        } else if (!strncmp(command, "normalize", 9)){
+            normalize = !normalize;
+            printf("Normalized rendering %s\n\n", normalize ? "on" : "off");
+            continue;
+        } else if (!strncmp(command, "search", 6)){
+            U64 first = strtoull(command + 6, &end, 10);
+            U64 last = strtoull(end, &end, 10);
+
+            if(last < first){
+                printf("[ERROR] usage: search <first seed> <last seed>\n\n");
+            } else {
+                search(first, last, depth);
+            }
+
+            continue;
+        } else if (!strncmp(command, "batch", 5)){
+            U64 first = strtoull(command + 5, &end, 10);
+            U64 last = strtoull(end, &end, 10);
+            int queued = 0, cached = 0, resumed = 0, first_id = 0, last_id = 0;
+
+            if(last < first){
+                printf("[ERROR] usage: batch <first seed> <last seed>\n\n");
+                continue;
+            }
+
+            // progress of earlier runs of the same batch, see journal.h
+            Journal* journal = open_journal(first, last, depth);
+
+            for(U64 s = first; s <= last; ++s){
+                char path[64];
+                snprintf(path, sizeof(path), "batch_%llu.png", (unsigned long long)s);
+
+                if(journal_has(journal, s)){
+                    resumed++;
+                    if(s == last) break;
+                    continue;
+                }
+
+                int valid = build_seed(s, depth, 0) == 0;
+                Render_plan plan = valid ? plan_render(analyse_cost(ast.ast_root)) : (Render_plan){0};
+
+                if(!valid){
+                    printf("[ERROR] seed %llu gives an invalid AST\n", (unsigned long long)s);
+                    journal_skip(journal, s);
+
+                } else if (plan.refuse){
+                    printf("Seed %llu is too expensive to render\n", (unsigned long long)s);
+                    journal_skip(journal, s);
+
+                } else {
+                    char name[CACHE_NAME_SIZE];
+                    struct stat st;
+                    cache_name(name, cache.enabled ? ast_hash() : 0, IMAGE_SIZE, plan.size, 0, "png");
+
+                    if(cache_fetch(name, path) == 0){
+                        cached++;
+
+                        if(stat(path, &st) == 0) journal_done(journal, s, st.st_size);
+                    } else {
+                        last_id = submit_batch_render(plan.size, path, cache.enabled ? name : NULL, journal, s);
+                        first_id = first_id ? first_id : last_id;
+                        queued++;
+                    }
+                }
+
+                if(s == last) break; // the range may end at the largest seed
+            }
+
+            journal_release(journal);
+
+            if(resumed){
+                printf("Resuming, %d seeds were finished by earlier runs\n", resumed);
+            }
+
+            if(cached){
+                printf("Copied %d renders from the render cache\n", cached);
+            }
+
+            printf("Queued %d batch renders to batch_<seed>.png as jobs %d to %d\n\n", queued, first_id, last_id);
+            continue;
+        } else if (!strncmp(command, "pipeline", 8)){
+            U64 first = strtoull(command + 8, &end, 10);
+            U64 last = strtoull(end, &end, 10);
+            int threads[3];
+            int valid = last >= first;
+
+            init_pool();
+
+            // render threads default to one per core, encoding and writing to one each
+            for(int i = 0; i < 3; ++i){
+                threads[i] = strtol(end, &end, 10);
+                threads[i] = threads[i] ? threads[i] : (i ? 1 : pool.n_threads);
+                valid &= (threads[i] > 0) && (threads[i] <= PIPELINE_MAX_THREADS);
+            }
+
+            if(!valid){
+                printf("[ERROR] usage: pipeline <first seed> <last seed> [render threads] [encode threads] [write threads], at most %d each\n\n", PIPELINE_MAX_THREADS);
+            } else {
+                run_pipeline(first, last, depth, threads);
+                printf("\n");
+            }
+
+            continue;
+        } else if (!strncmp(command, "dataset", 7)){
+            U64 first = strtoull(command + 7, &end, 10);
+            U64 last = strtoull(end, &end, 10);
+            long size = strtol(end, &end, 10);
+            Pixel_format format = strstr(end, "png") ? PF_PNG : PF_RAW;
+
+            size = size ? size : IMAGE_SIZE;
+
+            if((last < first) || (size < TILE_SIZE) || (size > IMAGE_SIZE) || (size & (size - 1))){
+                printf("[ERROR] usage: dataset <first seed> <last seed> [size, a power of 2 from %d to %d] [raw or png]\n\n", TILE_SIZE, IMAGE_SIZE);
+            } else {
+                write_dataset(first, last, depth, size, format);
+                printf("\n");
+            }
+
+            continue;
+        } else if (!strncmp(command, "record", 6)){
+            char* pack = command + 7;
+            char* seed_text = strrchr(pack, ' ');
+
+            if((command[6] != ' ') || (seed_text == NULL)){
+                printf("[ERROR] usage: record <shard>.pack <seed>\n\n");
+                continue;
+            }
+
+            *seed_text = '\0';
+
+            // the image is the record's own, rendering the AST again would overwrite it
+            if(read_record(pack, strtoull(seed_text + 1, &end, 10), "randomart.png") == 0){
+                print_ast_ln(ast.ast_root);
+            }
+
+            printf("\n");
+            continue;
+        } else if (!strncmp(command, "jobs", 4)){
+
+            if(command[4] == ' '){
+                sched_set_max_running(strtol(command + 5, &end, 10));
+            }
+
+            print_jobs();
+            printf("\n");
+            continue;
+        } else if (!strncmp(command, "cancel", 6)){
+
+            if(sched_cancel(strtol(command + 6, &end, 10)) != 0){
+                printf("[ERROR] no such job\n");
+            }
+
+            printf("\n");
+            continue;
+        } else if (!strncmp(command, "serve", 5)){
+
+            if(command[5] != ' '){
+                printf("[ERROR] usage: serve <socket path>\n\n");
+            } else {
+                serve(command + 6, depth);
+            }
+
+            continue;
+        } else if (!strncmp(command, "distribute", 10)){
+            char* address = command + 11;
+            char* local = strchr(address, ' ');
+            long n_local = 0;
+
+            if(local != NULL){
+                *local = '\0';
+                n_local = strtol(local + 1, &end, 10);
+            }
+
+            if((command[10] != ' ') || (n_local < 0)){
+                printf("[ERROR] usage: distribute <unix:path or host:port> [local workers]\n\n");
+                continue;
+            }
+
+            if(coordinate(address, n_local) == 0){
+                mode = RM_DISTRIBUTE;
+                printf("Rendering with workers connecting to %s, %d started locally\n\n", coord.address, coord.n_local);
+            }
+
+            continue;
+        } else if (!strncmp(command, "work", 4)){
+
+            if(command[4] != ' '){
+                printf("[ERROR] usage: work <unix:path or host:port>\n\n");
+            } else {
+                work(command + 5);
+            }
+
+            continue;
+        } else if (!strncmp(command, "cache", 5)){
+
+            if(!strcmp(command + 5, " off")){
+                free_cache();
+                printf("Render cache off\n\n");
+                continue;
+            }
+
+            if(command[5] == ' '){
+                char* dir = command + 6;
+                char* cap = strchr(dir, ' ');
+                long cap_mb = CACHE_DEFAULT_MB;
+
+                if(cap != NULL){
+                    *cap = '\0';
+                    cap_mb = strtol(cap + 1, &end, 10);
+                }
+
+                if(cap_mb <= 0){
+                    printf("[ERROR] usage: cache <directory> [cap in MB], or cache off\n\n");
+                    continue;
+                }
+
+                open_cache(dir, cap_mb);
+            }
+
+            print_cache();
+            printf("\n");
+            continue;
+        } else if (!strncmp(command, "planes", 6)){
+
+            if(command[6] == ' '){
+                long mb = strtol(command + 7, &end, 10);
+
+                if(mb < 0){
+                    printf("[ERROR] usage: planes <budget in MB>, 0 turns the subtree plane cache off\n\n");
+                    continue;
+                }
+
+                set_plane_budget(mb);
+            }
+
+            print_planes();
+            printf("\n");
+            continue;
+        } else if (!strncmp(command, "calibrate", 9)){
+            calibrate_cost_model();
+            continue;
+        } else if (!strncmp(command, "save", 4)){
+
+            if(ast.size == 0){
+                printf("[ERROR] no AST to save yet\n\n");
+            } else if (save_ast(ast.size - 1, command + 5) == 0){
+                printf("Saved AST to %s\n\n", command + 5);
+            }
+
+            continue;
+        } else if (!strncmp(command, "load", 4)){
+
+            if(is_packed_file(command + 5)){
+                Packed_ast packed_ast;
+
+                if(map_packed_ast(command + 5, &packed_ast, 1) != 0){
+                    continue;
+                }
+
+                adopt_packed_ast(&packed_ast);
+                packed = 1;
+
+            } else if(parse_file(command + 5) != 0){
+                printf("[ERROR] could not parse AST from %s\n\n", command + 5);
+                continue;
+            }
+
+        } else if (!strncmp(command, "explore", 7)){
+
+            if(explore(seed, depth) != 0){
+                printf("\n");
+                continue;
+            }
+
+            print_ast_ln(ast.ast_root);
+
         } else if (parse(command) != 0){
             srand(seed);
 
@@ -57,18 +377,104 @@ void run(){
             print_ast_ln(ast.ast_root);
         }
 
+        if(!packed){
+            size_t removed = simplify_ast();
+
+            if(removed){
+                printf("simplified AST: removed %ld nodes, %ld left\n", removed, ast.used);
+            }
+
+            size_t fused = peephole_ast();
+
+            if(fused){
+                printf("fused AST: removed %ld nodes, %ld left\n", fused, ast.used);
+            }
+        }
+
         ast.size = ast.used; // set size of AST right after generating it
         reallocate_ast_after_build();
 
+        // everything after this evaluates the AST without checking it
+        if(check_ast(ast.ast_root) != 0){
+            printf("[ERROR] AST is invalid! Cannot evaluate it\n\n");
+            continue;
+        }
+
+        Cost cost = analyse_cost(ast.ast_root);
+        print_cost(cost);
+
         if(mode == RM_TEST){
             printf("Testing AST on random point.....\n");
             test_eval();
             printf("\n");
 
+        } else if ((mode == RM_RENDER) && (deadline_ms > 0)){
+            Render_report report;
+            Render_stats stats;
+
+            printf("Rendering image.....\n");
+
+            if(render_with_deadline(cost, "randomart.png", deadline_ms, show_stats ? &stats : NULL, normalize, &report) == 0){
+                print_render_report(&report);
+
+                if(show_stats) print_render_stats(&stats);
+            }
+
+            printf("\n");
+
         } else if (mode == RM_RENDER){
+            Render_plan plan = plan_render(cost);
+
+            if(plan.refuse){
+                printf("[ERROR] AST is too expensive to render, predicted %.0f ms even at %dx%d\n\n", predicted_ms(cost, plan.size), plan.size, plan.size);
+                continue;
+            }
+
+            if(plan.size != IMAGE_SIZE){
+                printf("Degrading render to %dx%d to fit %.0f ms budget\n", plan.size, plan.size, RENDER_BUDGET_MS);
+            }
+
+            // statistics are worked out while rendering, so with them on the cache isn't used
+            char name[CACHE_NAME_SIZE];
+            int use_cache = cache.enabled && !show_stats;
+
+            if(use_cache){
+                cache_name(name, ast_hash(), IMAGE_SIZE, plan.size, normalize, "png");
+
+                if(cache_fetch(name, "randomart.png") == 0){
+                    printf("Copied image from the render cache\n\n");
+                    continue;
+                }
+            }
+
             printf("Rendering image.....\n");
-            render_image();
+            Render_stats stats;
+            int result = render_image(plan.size, "randomart.png", show_stats ? &stats : NULL, normalize, 1);
+
+            if((result == 0) && show_stats){
+                print_render_stats(&stats);
+            }
+
+            if((result == 0) && use_cache){
+                cache_store(name, "randomart.png");
+            }
+
             printf("\n");
+
+        } else if (mode == RM_DISTRIBUTE){
+            Render_plan plan = plan_render(cost);
+
+            if(plan.refuse){
+                printf("[ERROR] AST is too expensive to render, predicted %.0f ms even at %dx%d\n\n", predicted_ms(cost, plan.size), plan.size, plan.size);
+                continue;
+            }
+
+            printf("Rendering image on workers.....\n");
+            render_distributed(plan.size, "randomart.png");
+            printf("\n");
+
+        } else if (mode == RM_PREVIEW){
+            preview(cost, normalize);
         }
 
     }
@@ -0,0 +1,361 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "utils.h"
+#include "pool.h"
+
+/*
+    Scheduler for jobs that share the pool, like renders. A job is split into phases of units, and units of one phase
+    can run in any order and in parallel, but only once every unit of the phase before has finished. Pool threads are
+    handed one unit at a time, from whichever running job has had the least time weighted by its priority class (stride
+    scheduling), so interactive jobs get most of the pool without starving batch jobs, and jobs of the same class share it
+    evenly. Cancellation is cooperative: a cancelled job is handed no more units, and ends once the ones running are done.
+
+    Batch jobs only start while fewer than `max_running` jobs run, and interactive jobs get one slot more, so an interactive
+    job never waits for a batch job to finish. Queued jobs start in priority order.
+*/
+
+#define SCHED_MAX_RUNNING 4
+#define SCHED_INTERACTIVE_WEIGHT 8.0 // share of the pool an interactive job gets for every share of a batch job
+
+typedef enum {
+    PRIO_INTERACTIVE,
+    PRIO_BATCH
+} Priority;
+
+typedef enum {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_ENDING, // every unit has run, waiting for the done callback
+} Job_state;
+
+const char* priority_names[] = {"interactive", "batch"};
+const char* job_state_names[] = {"queued", "running", "ending"};
+
+/// @brief Called once every unit of `phase` has run, and with phase -1 when the job starts
+/// @return number of units in the next phase, 0 to end the job
+typedef int (*Phase_func)(void* ctx, int phase);
+typedef void (*Unit_func)(void* ctx, int phase, int unit);
+/// @brief Called once the job has ended, on the pool thread that ran its last unit
+typedef void (*Done_func)(void* ctx, int cancelled);
+
+typedef struct Sched_job {
+    int id;
+    Priority priority;
+    char name[64];
+
+    void* ctx;
+    Phase_func next_phase;
+    Unit_func run_unit;
+    Done_func done;
+
+    Job_state state;
+    int phase;
+    int units; // in the current phase
+    int handed_out;
+    int finished;
+    int cancelled;
+    int advancing; // its `next_phase` is running, outside the lock
+    double pass; // time taken so far, weighted by priority class
+
+    struct Sched_job* next;
+} Sched_job;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    Sched_job* jobs; // unfinished jobs, in the order they were submitted
+    int max_running;
+    int running;
+    int in_flight; // unit tasks queued on the pool or running
+    int waiting; // unit tasks queued on the pool that haven't picked a unit yet
+    size_t pool_pending;
+    int next_id;
+} Scheduler;
+
+Scheduler sched = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER,
+    .max_running = SCHED_MAX_RUNNING,
+    .next_id = 1
+};
+
+void unit_task(void* arg);
+
+/// @brief Remove a job that has ended and call its done callback outside the lock. Called with the lock held
+void end_job(Sched_job* job){
+    if(job->state == JOB_RUNNING){
+        sched.running--;
+    }
+
+    job->state = JOB_ENDING;
+
+    pthread_mutex_unlock(&sched.lock);
+    job->done(job->ctx, job->cancelled);
+    pthread_mutex_lock(&sched.lock);
+
+    for(Sched_job** j = &sched.jobs; *j != NULL; j = &(*j)->next){
+        if(*j == job){
+            *j = job->next;
+            break;
+        }
+    }
+
+    free(job);
+    pthread_cond_broadcast(&sched.changed);
+}
+
+/// @brief Move a job on to its next phase, calling `next_phase` outside the lock as `end_job` calls `done`, since it may allocate the job's
+/// @brief buffers. None of its units are handed out meanwhile, and a job cancelled meanwhile ends once it returns. Called with the lock held
+/// @param job
+/// @param phase that has just finished, -1 when the job starts
+void advance_job(Sched_job* job, int phase){
+    job->units = job->handed_out = job->finished = 0;
+    job->advancing = 1;
+
+    pthread_mutex_unlock(&sched.lock);
+    int units = job->next_phase(job->ctx, phase);
+    pthread_mutex_lock(&sched.lock);
+
+    job->advancing = 0;
+    job->units = units;
+    pthread_cond_broadcast(&sched.changed);
+
+    if((units == 0) || job->cancelled){
+        end_job(job);
+    }
+}
+
+/// @brief Start queued jobs while there are free slots, interactive ones first. Called with the lock held
+void admit_jobs(){
+    while(1){
+        Sched_job* best = NULL;
+
+        for(Sched_job* j = sched.jobs; j != NULL; j = j->next){
+            if((j->state == JOB_QUEUED) && ((best == NULL) || (j->priority < best->priority))){
+                best = j;
+            }
+        }
+
+        // one slot is kept back for interactive jobs
+        int slots = sched.max_running - sched.running + ((best != NULL) && (best->priority == PRIO_INTERACTIVE));
+
+        if((best == NULL) || (slots <= 0)){
+            return;
+        }
+
+        // start level with the job furthest behind, so that a new job neither waits for the others to catch up nor gets the pool to itself
+        best->pass = INFINITY;
+
+        for(Sched_job* j = sched.jobs; j != NULL; j = j->next){
+            if(j->state == JOB_RUNNING) best->pass = fmin(best->pass, j->pass);
+        }
+
+        best->pass = isinf(best->pass) ? 0 : best->pass;
+        best->state = JOB_RUNNING;
+        sched.running++;
+
+        if(best->cancelled){
+            end_job(best);
+        } else {
+            advance_job(best, -1);
+        }
+    }
+}
+
+/// @brief Queue a unit task on the pool for every unit that can run, up to one per pool thread. Called with the lock held
+void dispatch_units(){
+    int runnable = 0;
+
+    for(Sched_job* j = sched.jobs; j != NULL; j = j->next){
+        if((j->state == JOB_RUNNING) && !j->cancelled){
+            runnable += j->units - j->handed_out;
+        }
+    }
+
+    while((sched.in_flight < pool.n_threads) && (runnable > sched.waiting)){
+        sched.in_flight++;
+        sched.waiting++;
+        pool_submit_to(&sched.pool_pending, unit_task, NULL);
+    }
+}
+
+/// @brief Run one unit of the running job that is furthest behind its share of the pool, then queue more work
+void unit_task(void* arg){
+    (void)arg;
+
+    pthread_mutex_lock(&sched.lock);
+
+    Sched_job* job = NULL;
+    sched.waiting--;
+
+    for(Sched_job* j = sched.jobs; j != NULL; j = j->next){
+        if((j->state == JOB_RUNNING) && !j->cancelled && (j->handed_out < j->units) && ((job == NULL) || (j->pass < job->pass))){
+            job = j;
+        }
+    }
+
+    if(job == NULL){
+        sched.in_flight--;
+        pthread_mutex_unlock(&sched.lock);
+        return;
+    }
+
+    int phase = job->phase, unit = job->handed_out++;
+    double start = now_ns();
+
+    pthread_mutex_unlock(&sched.lock);
+    job->run_unit(job->ctx, phase, unit);
+    pthread_mutex_lock(&sched.lock);
+
+    job->pass += (now_ns() - start) / ((job->priority == PRIO_INTERACTIVE) ? SCHED_INTERACTIVE_WEIGHT : 1.0);
+    job->finished++;
+
+    if(job->finished == job->handed_out){
+        if(job->cancelled){
+            end_job(job);
+
+        } else if(job->finished == job->units){
+            advance_job(job, job->phase++);
+        }
+    }
+
+    sched.in_flight--;
+    admit_jobs();
+    dispatch_units();
+
+    pthread_mutex_unlock(&sched.lock);
+}
+
+/// @brief Queue a job. It starts once there is a free slot, see `admit_jobs`, and `ctx` must stay valid until `done` is called
+/// @param priority
+/// @param name shown by `print_jobs`
+/// @param ctx
+/// @param next_phase
+/// @param run_unit
+/// @param done
+/// @return id of the job
+int sched_submit(Priority priority, const char* name, void* ctx, Phase_func next_phase, Unit_func run_unit, Done_func done){
+    Sched_job* job = (Sched_job*)calloc(1, sizeof(Sched_job));
+    assert(job != NULL);
+
+    *job = (Sched_job){.priority = priority, .ctx = ctx, .next_phase = next_phase, .run_unit = run_unit, .done = done, .state = JOB_QUEUED};
+    snprintf(job->name, sizeof(job->name), "%s", name);
+
+    init_pool();
+    pthread_mutex_lock(&sched.lock);
+
+    job->id = sched.next_id++;
+
+    Sched_job** last = &sched.jobs;
+    while(*last != NULL) last = &(*last)->next;
+    *last = job;
+
+    int id = job->id;
+
+    admit_jobs();
+    dispatch_units();
+
+    pthread_mutex_unlock(&sched.lock);
+
+    return id;
+}
+
+Sched_job* find_job(int id){
+    for(Sched_job* j = sched.jobs; j != NULL; j = j->next){
+        if(j->id == id) return j;
+    }
+
+    return NULL;
+}
+
+/// @brief Block until job `id` has ended
+void sched_wait(int id){
+    pthread_mutex_lock(&sched.lock);
+
+    while(find_job(id) != NULL){
+        pthread_cond_wait(&sched.changed, &sched.lock);
+    }
+
+    pthread_mutex_unlock(&sched.lock);
+}
+
+/// @brief Cancel job `id`. Units that are running finish, then its done callback is called with `cancelled` set
+/// @return -1 if there is no such job
+int sched_cancel(int id){
+    pthread_mutex_lock(&sched.lock);
+
+    Sched_job* job = find_job(id);
+
+    if((job != NULL) && (job->state != JOB_ENDING)){
+        job->cancelled = 1;
+
+        // an advancing job ends when its `next_phase` returns
+        if((job->state == JOB_QUEUED) || (!job->advancing && (job->finished == job->handed_out))){
+            end_job(job);
+        }
+    }
+
+    pthread_mutex_unlock(&sched.lock);
+
+    return (job == NULL) ? -1 : 0;
+}
+
+/// @brief Change how many batch jobs can run at once, interactive jobs can run one more. Jobs already running keep running
+void sched_set_max_running(int max_running){
+    pthread_mutex_lock(&sched.lock);
+
+    sched.max_running = (max_running < 1) ? 1 : max_running;
+    admit_jobs();
+    dispatch_units();
+
+    pthread_mutex_unlock(&sched.lock);
+}
+
+void print_jobs(){
+    pthread_mutex_lock(&sched.lock);
+
+    printf("%d running, batch jobs take at most %d slots and interactive ones one more\n", sched.running, sched.max_running);
+
+    for(Sched_job* j = sched.jobs; j != NULL; j = j->next){
+        printf("%4d %-11s %-8s %s", j->id, priority_names[j->priority], job_state_names[j->state], j->name);
+
+        if(j->state == JOB_RUNNING){
+            printf(", phase %d, %d of %d units done", j->phase, j->finished, j->units);
+        }
+
+        printf("%s\n", j->cancelled ? ", cancelled" : "");
+    }
+
+    pthread_mutex_unlock(&sched.lock);
+}
+
+/// @brief Cancel every job and wait for them to end
+void free_scheduler(){
+    pthread_mutex_lock(&sched.lock);
+
+    while(sched.jobs != NULL){
+        Sched_job* idle = NULL;
+
+        for(Sched_job* j = sched.jobs; j != NULL; j = j->next){
+            j->cancelled = 1;
+
+            if((j->state == JOB_QUEUED) || ((j->state == JOB_RUNNING) && !j->advancing && (j->finished == j->handed_out))){
+                idle = j;
+            }
+        }
+
+        if(idle != NULL){
+            end_job(idle);
+        } else {
+            pthread_cond_wait(&sched.changed, &sched.lock);
+        }
+    }
+
+    pthread_mutex_unlock(&sched.lock);
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdio.h>
+#include "grammar.h"
+#include "simplify.h"
+#include "peephole.h"
+#include "check.h"
+#include "cost.h"
+#include "render.h"
+#include "pool.h"
+
+/*
+    Seed search. Each seed's AST is generated on the main thread, since generation depends on the global `rand` state, then
+    a snapshot of its nodes is probed on a tiny grid by the pool. Flat images have a low variance, and smooth gradients and
+    noise have too few or too many edges between neighbouring probe pixels. Only seeds that pass get a full render.
+*/
+
+#define PROBE_SIZE 16
+#define SEARCH_BATCH 256 // seeds generated before waiting for their probes
+#define SEARCH_MAX_RENDERS 32
+#define SEARCH_MIN_VARIANCE 150.0 // in squared 8 bit levels, averaged over the channels
+#define SEARCH_EDGE_LEVELS 24 // neighbouring probe pixels further apart than this in any channel are an edge
+#define SEARCH_MIN_EDGES 0.05 // fraction of neighbouring probe pixel pairs that are edges
+#define SEARCH_MAX_EDGES 0.6
+
+typedef struct {
+    U64 seed;
+    Node* nodes; // snapshot of the AST, owned by the probe until it has run
+    uint32_t root;
+
+    float variance;
+    float edges;
+    int pass;
+} Probe;
+
+/// @brief Run the passes every AST goes through before it is evaluated on the AST just built in `ast`
+/// @return 0 if the AST can be evaluated
+int finish_ast(){
+    simplify_ast();
+    peephole_ast();
+
+    ast.size = ast.used;
+    reallocate_ast_after_build();
+
+    return check_ast(ast.ast_root);
+}
+
+/// @brief Generate the AST for `seed` into `ast`, see `finish_ast`
+/// @param seed
+/// @param depth
+/// @param max_nodes give up once the AST grows past this many nodes, 0 for no limit
+/// @return 0 if the AST can be evaluated, -2 if it grew past `max_nodes`, any other value if it is invalid
+int build_seed(U64 seed, int depth, size_t max_nodes){
+    reset_ast();
+    srand(seed);
+
+    node_budget = max_nodes;
+    over_budget = 0;
+    generate_ast(g.entry_point, depth);
+    node_budget = 0;
+
+    if(over_budget){
+        return -2;
+    }
+
+    return finish_ast();
+}
+
+/// @brief Evaluate a snapshotted AST on a `PROBE_SIZE` grid and score it. Runs on a pool thread
+/// @param arg `Probe*`
+void probe_job(void* arg){
+    Probe* p = (Probe*)arg;
+    unsigned char level[PROBE_SIZE][PROBE_SIZE][3];
+    double sum[3] = {0}, sum_sq[3] = {0};
+    int edges = 0;
+
+    for(int j = 0; j < PROBE_SIZE; ++j){
+        for(int i = 0; i < PROBE_SIZE; ++i){
+            float rgb[3];
+
+            eval_rgb(p->nodes, p->root, ((float)i / PROBE_SIZE) * 2.0 - 1.0, ((float)j / PROBE_SIZE) * 2.0 - 1.0, 0, rgb);
+
+            for(int c = 0; c < 3; ++c){
+                level[j][i][c] = quantize(rgb[c]);
+                sum[c] += level[j][i][c];
+                sum_sq[c] += level[j][i][c] * level[j][i][c];
+            }
+        }
+    }
+
+    for(int j = 0; j < PROBE_SIZE; ++j){
+        for(int i = 0; i < PROBE_SIZE; ++i){
+            int right = 0, down = 0;
+
+            for(int c = 0; c < 3; ++c){
+                if(i + 1 < PROBE_SIZE) right |= abs(level[j][i][c] - level[j][i + 1][c]) > SEARCH_EDGE_LEVELS;
+                if(j + 1 < PROBE_SIZE) down |= abs(level[j][i][c] - level[j + 1][i][c]) > SEARCH_EDGE_LEVELS;
+            }
+
+            edges += right + down;
+        }
+    }
+
+    const double n = PROBE_SIZE * PROBE_SIZE;
+    p->variance = 0;
+
+    for(int c = 0; c < 3; ++c){
+        p->variance += (sum_sq[c] / n - (sum[c] / n) * (sum[c] / n)) / 3;
+    }
+
+    p->edges = (float)edges / (2 * PROBE_SIZE * (PROBE_SIZE - 1));
+    p->pass = (p->variance >= SEARCH_MIN_VARIANCE) && (p->edges >= SEARCH_MIN_EDGES) && (p->edges <= SEARCH_MAX_EDGES);
+
+    free(p->nodes);
+    p->nodes = NULL;
+}
+
+/// @brief Scan seeds `first` to `last` at `depth`, and render the first `SEARCH_MAX_RENDERS` that pass to search_<seed>.png
+/// @param first
+/// @param last
+/// @param depth
+void search(U64 first, U64 last, int depth){
+    Probe* probes = (Probe*)malloc(sizeof(Probe) * SEARCH_BATCH);
+    U64* passed = NULL;
+    size_t n_passed = 0;
+    size_t scanned = 0;
+
+    assert(probes != NULL);
+    init_pool();
+
+    double start = now_ns();
+
+    for(U64 batch = first; batch <= last; batch += SEARCH_BATCH){
+        size_t n = ((last - batch) < SEARCH_BATCH) ? (size_t)(last - batch) + 1 : SEARCH_BATCH;
+
+        for(size_t i = 0; i < n; ++i){
+            Probe* p = probes + i;
+            *p = (Probe){.seed = batch + i};
+
+            if(build_seed(p->seed, depth, 0) != 0){
+                continue;
+            }
+
+            p->nodes = (Node*)malloc(sizeof(Node) * ast.used);
+            assert(p->nodes != NULL);
+            memcpy(p->nodes, ast.array, sizeof(Node) * ast.used);
+            p->root = ast.ast_root;
+
+            pool_submit(probe_job, p);
+        }
+
+        pool_wait();
+        scanned += n;
+
+        for(size_t i = 0; i < n; ++i){
+            if(!probes[i].pass) continue;
+
+            passed = (U64*)realloc(passed, sizeof(U64) * (n_passed + 1));
+            assert(passed != NULL);
+            passed[n_passed++] = probes[i].seed;
+        }
+
+        if(last - batch < SEARCH_BATCH) break; // the range may end at the largest seed
+    }
+
+    double seconds = (now_ns() - start) / 1e9;
+
+    printf("Scanned %ld seeds in %.2f s (%.0f seeds/s) on %d threads, %ld passed\n", scanned, seconds, scanned / seconds, pool.n_threads, n_passed);
+
+    for(size_t i = 0; i < n_passed; ++i){
+        if(i == SEARCH_MAX_RENDERS){
+            printf("Not rendering the other %ld seeds that passed\n", n_passed - i);
+            break;
+        }
+
+        char path[64];
+        snprintf(path, sizeof(path), "search_%llu.png", (unsigned long long)passed[i]);
+
+        build_seed(passed[i], depth, 0);
+        Render_plan plan = plan_render(analyse_cost(ast.ast_root));
+
+        if(plan.refuse){
+            printf("Seed %llu is too expensive to render\n", (unsigned long long)passed[i]);
+            continue;
+        }
+
+        render_image(plan.size, path, NULL, 0, 0);
+        printf("Rendered seed %llu to %s\n", (unsigned long long)passed[i], path);
+    }
+
+    printf("\n");
+
+    free(passed);
+    free(probes);
+}
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ast.h"
+#include "interpreter.h"
+
+/*
+    Binary AST format: a header followed by the nodes in post-order, so children always come before their parent. Nodes are
+    stored exactly as they are laid out in memory (see `Node`), with raw float constants so numbers survive the round trip. 
+    A file can be mapped and evaluated in place with `eval_packed_rgb`, or adopted as the node array of `ast`.
+*/
+
+#define PACKED_MAGIC "RAST"
+#define PACKED_VERSION 2 // version 2 added the fused nodes, version 1 files are still read
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t root;
+} Packed_header;
+
+typedef struct {
+    Node* nodes;
+    uint32_t count;
+    uint32_t root;
+
+    void* map;
+    size_t map_size;
+} Packed_ast;
+
+/// @brief Write the subtree at `index` to `f` in post-order
+/// @param index
+/// @param f
+/// @param count number of nodes written so far
+/// @return index of the node in the file
+uint32_t write_packed_node(size_t index, FILE* f, uint32_t* count){
+    Node p = ast.array[index];
+    Node_kind nk = node_kind(&p);
+
+    if(nk & NK_UNOP){
+        p.as.unop = write_packed_node(p.as.unop, f, count);
+
+    } else if (nk & NK_BINOP){
+        p.as.binop.lhs = write_packed_node(p.as.binop.lhs, f, count);
+        p.as.binop.rhs = write_packed_node(p.as.binop.rhs, f, count);
+
+    } else if (nk & (NK_TRIPLE | NK_TERNOP)){
+        p.as.triple.first = write_packed_node(p.as.triple.first, f, count);
+        p.as.triple.second = write_packed_node(p.as.triple.second, f, count);
+        p.as.triple.third = write_packed_node(p.as.triple.third, f, count);
+    }
+
+    fwrite(&p, sizeof(p), 1, f);
+
+    return (*count)++;
+}
+
+/// @brief Save the AST rooted at `root` to `path` in the binary format
+/// @param root
+/// @param path
+/// @return 0 on success
+int save_ast(size_t root, const char* path){
+    FILE* f = fopen(path, "wb");
+
+    if(f == NULL){
+        printf("[ERROR] could not open %s for writing\n", path);
+        return -1;
+    }
+
+    Packed_header header = {.magic = PACKED_MAGIC, .version = PACKED_VERSION};
+    fwrite(&header, sizeof(header), 1, f);
+
+    header.root = write_packed_node(root, f, &header.count);
+
+    // the node count is only known once the whole tree is written
+    fseek(f, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, f);
+
+    if(fclose(f) != 0){
+        printf("[ERROR] could not write %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/// @brief Check whether `path` starts with the binary AST magic
+int is_packed_file(const char* path){
+    char magic[4] = {0};
+    FILE* f = fopen(path, "rb");
+
+    if(f == NULL){
+        return 0;
+    }
+
+    size_t read = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+
+    return (read == sizeof(magic)) && !memcmp(magic, PACKED_MAGIC, sizeof(magic));
+}
+
+/// @brief Check that children come before their parents and only point at nodes of the right kind, so that the packed AST can be evaluated without checks, like `check_ast` does for `ast`
+/// @param p
+/// @return 0 if the packed AST is valid
+int validate_packed_ast(Packed_ast* p){
+    for(uint32_t i = 0; i < p->count; ++i){
+        const Node* n = p->nodes + i;
+
+        if(n->op >= N_NODE_KINDS){
+            printf("[ERROR] node %u has unknown opcode %u\n", i, n->op);
+            return -1;
+        }
+
+        Node_kind nk = node_kind(n);
+        int kids = (nk & NK_UNOP) ? 1 : (nk & NK_BINOP) ? 2 : (nk & (NK_TRIPLE | NK_TERNOP)) ? 3 : 0;
+        const uint32_t* kid = &n->as.triple.first; // children of every node kind share this layout
+
+        for(int k = 0; k < kids; ++k){
+            if(kid[k] >= i){
+                printf("[ERROR] node %u is not in post-order\n", i);
+                return -1;
+            }
+
+            // only if-then-else has E children, and only as its branches
+            int is_e = (node_kind(p->nodes + kid[k]) & NK_TRIPLE) != 0;
+            int want_e = (nk == NK_IF_THEN_ELSE) && (k > 0);
+
+            if(is_e != want_e){
+                printf("[ERROR] node %u has a child of the wrong kind\n", i);
+                return -1;
+            }
+        }
+    }
+
+    // the root is written last
+    if((p->count == 0) || (p->root != p->count - 1) || !(node_kind(p->nodes + p->root) & NK_TRIPLE)){
+        printf("[ERROR] AST root should be if or E!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/// @brief Map a binary AST file into memory. Nodes are used in place, nothing is copied
+/// @param path
+/// @param p
+/// @param evaluable reserve writable room after the mapped nodes, so that the AST can be evaluated by `eval` without moving it
+/// @return 0 on success
+int map_packed_ast(const char* path, Packed_ast* p, int evaluable){
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    Packed_header header;
+
+    if(fd < 0){
+        printf("[ERROR] could not open %s\n", path);
+        return -1;
+    }
+
+    if((fstat(fd, &st) < 0) || (pread(fd, &header, sizeof(header), 0) != sizeof(header))){
+        printf("[ERROR] %s is too small to hold an AST\n", path);
+        close(fd);
+        return -1;
+    }
+
+    if(memcmp(header.magic, PACKED_MAGIC, 4) || (header.version < 1) || (header.version > PACKED_VERSION) ||
+        (sizeof(Packed_header) + (size_t)header.count * sizeof(Node) != (size_t)st.st_size)){
+
+        printf("[ERROR] %s is not a binary AST of version %d or older\n", path, PACKED_VERSION);
+        close(fd);
+        return -1;
+    }
+
+    // reserve room for the headroom, then map the file over the start of it
+    size_t headroom = evaluable ? eval_headroom(header.count) : 0;
+    size_t map_size = st.st_size + headroom * sizeof(Node);
+    void* map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if((map == MAP_FAILED) || (mmap(map, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)){
+        printf("[ERROR] could not map %s\n", path);
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+
+    *p = (Packed_ast){
+        .nodes = (Node*)((Packed_header*)map + 1),
+        .count = header.count,
+        .root = header.root,
+        .map = map,
+        .map_size = map_size
+    };
+
+    if(validate_packed_ast(p) != 0){
+        munmap(map, map_size);
+        return -1;
+    }
+
+    return 0;
+}
+
+void unmap_packed_ast(Packed_ast* p){
+    munmap(p->map, p->map_size);
+    *p = (Packed_ast){0};
+}
+
+/// @brief Make a mapped packed AST the node array of `ast`, in place of whatever it held. `ast` takes ownership of the mapping
+/// @param p must have been mapped with enough headroom to evaluate it, see `reallocate_ast_after_build`
+void adopt_packed_ast(Packed_ast* p){
+    free_ast();
+
+    #ifdef DEBUG
+    ast.debug = (Node_debug*)calloc(p->map_size / sizeof(Node), sizeof(Node_debug));
+    assert(ast.debug != NULL);
+    #endif
+
+    ast.array = p->nodes;
+    ast.map = p->map;
+    ast.map_size = p->map_size;
+    ast.capacity = (p->map_size - sizeof(Packed_header)) / sizeof(Node);
+    ast.used = p->count;
+    ast.ast_root = p->root;
+
+    *p = (Packed_ast){0};
+}
+
+/// @brief Append the AST held in `ast`, which must have been built, to `t` in the binary format. Its node array is already in post-order
+/// @brief with the root last, so it is written as it is
+void pack_ast(Text* t){
+    Packed_header header = {.magic = PACKED_MAGIC, .version = PACKED_VERSION, .count = ast.size, .root = ast.size - 1};
+
+    text_append(t, &header, sizeof(header));
+    text_append(t, ast.array, sizeof(Node) * ast.size);
+}
+
+/// @brief Replace the AST held in `ast` with one in the binary format, from `pack_ast`
+/// @param data
+/// @param length
+/// @return 0 if it is a valid AST
+int unpack_ast(const void* data, size_t length){
+    Packed_header header;
+
+    if(length < sizeof(header)){
+        printf("[ERROR] packed AST is too small\n");
+        return -1;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    if(memcmp(header.magic, PACKED_MAGIC, 4) || (header.version < 1) || (header.version > PACKED_VERSION) ||
+        (sizeof(header) + (size_t)header.count * sizeof(Node) != length)){
+
+        printf("[ERROR] not a packed AST of version %d or older\n", PACKED_VERSION);
+        return -1;
+    }
+
+    reset_ast();
+
+    if(ast.capacity < header.count){
+        reallocate_ast(header.count);
+    }
+
+    memcpy(ast.array, (const Packed_header*)data + 1, sizeof(Node) * header.count);
+
+    Packed_ast p = {.nodes = ast.array, .count = header.count, .root = header.root};
+
+    ast.used = ast.size = header.count;
+    ast.ast_root = header.root;
+
+    if(validate_packed_ast(&p) != 0){
+        ast.used = ast.size = 0;
+        return -1;
+    }
+
+    reallocate_ast_after_build();
+
+    return 0;
+}
+
+/// @brief Evaluate the three channels of a packed AST whose root is an E, or an if-then-else of Es
+/// @param p
+/// @param x
+/// @param y
+/// @param rgb
+void eval_packed_rgb(const Packed_ast* p, float x, float y, float rgb[3]){
+    eval_rgb(p->nodes, p->root, x, y, 0, rgb);
+}
+
+#endif
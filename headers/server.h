@@ -0,0 +1,465 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include "grammar.h"
+#include "parser.h"
+#include "search.h"
+#include "render.h"
+#include "cost.h"
+#include "cache.h"
+
+/*
+    Render server. Listens on a Unix domain socket, keeping the grammar, the pool threads, the AST array and the sample
+    buffers warm between requests. Clients are multiplexed on an epoll loop, requests are rendered one at a time on the
+    loop's thread, each by the whole pool.
+
+    Every frame starts with its length as a 32 bit big endian integer. A request is text made of `key value` pairs:
+
+        seed <n>, depth <n>, size <power of 2 from 16 to 512>, format <png|bmp|jpg|ppm>, expr <function, to the end of the frame>
+
+    Missing keys default to a random seed, the current depth, 512 and png. An `expr` is rendered instead of generating
+    from a seed. Generation gives up past `SERVER_MAX_NODES` nodes, since deep grammars grow without bound and one
+    request must not take the server down. The request `shutdown` stops the server. Each response is a 32 bit big endian status, 0 for an image and
+    1 for an error, then a frame holding the image or the error message.
+*/
+
+#define SERVER_MAX_CLIENTS 64
+#define SERVER_MAX_REQUEST (1 << 20)
+#define SERVER_EVENTS 64
+#define SERVER_READ_SIZE 65536
+#define SERVER_MAX_NODES (1 << 20) // far more than a render that isn't refused can evaluate
+
+typedef struct {
+    int fd;
+    Text in;
+    Text out;
+    size_t sent; // bytes of `out` already written to the socket
+    int closing; // close once `out` is sent
+} Client;
+
+typedef struct {
+    U64 seed;
+    int depth;
+    int size;
+    const char* format;
+    const char* expr;
+} Render_request;
+
+const char* server_formats[] = {"png", "bmp", "jpg", "ppm"};
+
+Client* clients[SERVER_MAX_CLIENTS];
+Pixel server_canvas[IMAGE_SIZE][IMAGE_SIZE];
+Text request_text;
+unsigned char* server_pixels;
+
+void put_u32(Text* t, uint32_t v){
+    uint32_t be = htonl(v);
+    text_append(t, &be, sizeof(be));
+}
+
+/// @brief Queue a response to `c`
+/// @param c
+/// @param status 0 for an image, 1 for an error message
+/// @param body
+/// @param length
+void respond(Client* c, uint32_t status, const void* body, size_t length){
+    put_u32(&c->out, status);
+    put_u32(&c->out, length);
+    text_append(&c->out, body, length);
+}
+
+void respond_error(Client* c, const char* message){
+    printf("[ERROR] %s\n", message);
+    respond(c, 1, message, strlen(message));
+}
+
+void write_to_text(void* context, void* data, int size){
+    text_append((Text*)context, data, size);
+}
+
+/// @brief Parse the text of a request, `expr` takes the rest of it
+/// @param text
+/// @param length of `text`, which gets split up in place
+/// @param req
+/// @return 0 if every key was understood
+int parse_request(char* text, size_t length, Render_request* req){
+    char* key = strtok(text, " \t\r\n");
+
+    while(key != NULL){
+        if(!strcmp(key, "expr")){
+            req->expr = key + 5;
+            return (key + 5 > text + length) ? -1 : 0;
+        }
+
+        char* value = strtok(NULL, " \t\r\n");
+
+        if(value == NULL){
+            return -1;
+        } else if(!strcmp(key, "seed")){
+            req->seed = strtoull(value, NULL, 10);
+        } else if(!strcmp(key, "depth")){
+            req->depth = fmin(MAX_DEPTH, strtol(value, NULL, 10));
+        } else if(!strcmp(key, "size")){
+            req->size = strtol(value, NULL, 10);
+        } else if(!strcmp(key, "format")){
+            req->format = value;
+        } else {
+            return -1;
+        }
+
+        key = strtok(NULL, " \t\r\n");
+    }
+
+    return 0;
+}
+
+/// @brief Build and render the AST a request asks for, and queue the encoded image or an error as the response
+/// @param c
+/// @param frame
+/// @param length
+/// @param depth used if the request doesn't give one
+void serve_request(Client* c, const char* frame, size_t length, int depth){
+    Render_request req = {.seed = (U64)time(NULL), .depth = depth, .size = IMAGE_SIZE, .format = "png"};
+    double start = now_ns();
+
+    request_text.used = 0;
+    text_append(&request_text, frame, length);
+    text_char(&request_text, '\0');
+
+    if(parse_request(request_text.data, length, &req) != 0){
+        respond_error(c, "bad request, expected key value pairs of seed, depth, size, format or expr");
+        return;
+    }
+
+    int format = -1;
+
+    for(int f = 0; f < (int)(sizeof(server_formats) / sizeof(server_formats[0])); ++f){
+        if(!strcmp(req.format, server_formats[f])) format = f;
+    }
+
+    if(format < 0){
+        respond_error(c, "unknown format, expected png, bmp, jpg or ppm");
+        return;
+    }
+
+    if((req.size < TILE_SIZE) || (req.size > IMAGE_SIZE) || (req.size & (req.size - 1))){
+        respond_error(c, "size must be a power of 2 from 16 to 512");
+        return;
+    }
+
+    if(req.expr != NULL){
+        reset_ast();
+
+        if(parse(req.expr) != 0){
+            respond_error(c, "could not parse expression");
+            return;
+        }
+    }
+
+    int built = (req.expr != NULL) ? finish_ast() : build_seed(req.seed, req.depth, SERVER_MAX_NODES);
+
+    if(built == -2){
+        respond_error(c, "AST is too big, try a smaller depth");
+        return;
+    }
+
+    if(built != 0){
+        respond_error(c, "AST is invalid, cannot evaluate it");
+        return;
+    }
+
+    Render_plan plan = plan_render(analyse_cost(ast.ast_root));
+
+    if(plan.refuse){
+        respond_error(c, "AST is too expensive to render");
+        return;
+    }
+
+    // sampled on a coarser grid if a full render would be too slow, like the prompt does
+    int grid = (req.size < plan.size) ? req.size : plan.size;
+    char name[CACHE_NAME_SIZE];
+
+    if(cache.enabled){
+        cache_name(name, ast_hash(), req.size, grid, 0, server_formats[format]);
+        put_u32(&c->out, 0);
+
+        size_t length_at = c->out.used;
+        put_u32(&c->out, 0);
+
+        if(cache_read(name, &c->out) == 0){
+            uint32_t image_length = htonl(c->out.used - length_at - sizeof(uint32_t));
+            memcpy(c->out.data + length_at, &image_length, sizeof(image_length));
+
+            printf("Served %dx%d %s of %u bytes from the render cache in %.1f ms\n", req.size, req.size, server_formats[format], ntohl(image_length), (now_ns() - start) / 1e6);
+            return;
+        }
+
+        c->out.used = length_at - sizeof(uint32_t);
+    }
+
+    Render r = {.size = grid, .scale = req.size / grid, .canvas = server_canvas};
+
+    render_canvas(&r, NULL);
+
+    int channels = (format == 3) ? 3 : 4;
+
+    for(int y = 0; y < req.size; ++y){
+        for(int x = 0; x < req.size; ++x){
+            memcpy(server_pixels + ((size_t)y * req.size + x) * channels, server_canvas[y] + x, channels);
+        }
+    }
+
+    put_u32(&c->out, 0);
+    size_t length_at = c->out.used;
+    put_u32(&c->out, 0);
+
+    int ok = 1;
+
+    switch(format){
+        case 0: ok = stbi_write_png_to_func(write_to_text, &c->out, req.size, req.size, 4, server_pixels, req.size * 4); break;
+        case 1: ok = stbi_write_bmp_to_func(write_to_text, &c->out, req.size, req.size, 4, server_pixels); break;
+        case 2: ok = stbi_write_jpg_to_func(write_to_text, &c->out, req.size, req.size, 4, server_pixels, 90); break;
+        default:
+            text_printf(&c->out, "P6\n%d %d\n255\n", req.size, req.size);
+            text_append(&c->out, server_pixels, (size_t)req.size * req.size * 3);
+    }
+
+    if(!ok){
+        c->out.used = length_at - sizeof(uint32_t);
+        respond_error(c, "could not encode image");
+        return;
+    }
+
+    uint32_t image_length = htonl(c->out.used - length_at - sizeof(uint32_t));
+    memcpy(c->out.data + length_at, &image_length, sizeof(image_length));
+
+    if(cache.enabled){
+        cache_write(name, c->out.data + length_at + sizeof(uint32_t), ntohl(image_length));
+    }
+
+    printf("Served %dx%d %s of %u bytes in %.1f ms\n", req.size, req.size, server_formats[format], ntohl(image_length), (now_ns() - start) / 1e6);
+}
+
+/// @brief Write as much of the client's pending output as the socket takes without blocking
+/// @return -1 if the client is gone
+int flush_client(Client* c){
+    while(c->sent < c->out.used){
+        ssize_t n = send(c->fd, c->out.data + c->sent, c->out.used - c->sent, MSG_NOSIGNAL);
+
+        if(n < 0){
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+        }
+
+        c->sent += n;
+    }
+
+    c->out.used = c->sent = 0;
+
+    return 0;
+}
+
+void close_client(int ep, Client* c){
+    epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+
+    for(int i = 0; i < SERVER_MAX_CLIENTS; ++i){
+        if(clients[i] == c) clients[i] = NULL;
+    }
+
+    free(c->in.data);
+    free(c->out.data);
+    free(c);
+}
+
+void accept_clients(int ep, int listener){
+    while(1){
+        int fd = accept(listener, NULL, NULL);
+
+        if(fd < 0){
+            return;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        int slot = 0;
+
+        while((slot < SERVER_MAX_CLIENTS) && (clients[slot] != NULL)) slot++;
+
+        if(slot == SERVER_MAX_CLIENTS){
+            printf("[ERROR] more than %d clients, refusing connection\n", SERVER_MAX_CLIENTS);
+            close(fd);
+            continue;
+        }
+
+        Client* c = (Client*)calloc(1, sizeof(Client));
+        assert(c != NULL);
+        c->fd = fd;
+        clients[slot] = c;
+
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+        epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+/// @brief Read what the client sent and serve every complete request in it
+/// @return 1 if a client asked for the server to shut down, -1 if the client is gone
+int read_client(Client* c, int depth){
+    int stop = 0;
+
+    while(1){
+        text_reserve(&c->in, SERVER_READ_SIZE);
+        ssize_t n = recv(c->fd, c->in.data + c->in.used, SERVER_READ_SIZE, 0);
+
+        if(n == 0){
+            return -1;
+        } else if(n < 0){
+            if((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+            return -1;
+        }
+
+        c->in.used += n;
+    }
+
+    size_t at = 0;
+
+    while(!c->closing && (c->in.used - at >= sizeof(uint32_t))){
+        uint32_t length;
+        memcpy(&length, c->in.data + at, sizeof(length));
+        length = ntohl(length);
+
+        if(length > SERVER_MAX_REQUEST){
+            respond_error(c, "request too big");
+            c->closing = 1;
+            break;
+        }
+
+        if(c->in.used - at - sizeof(uint32_t) < length) break;
+
+        const char* frame = c->in.data + at + sizeof(uint32_t);
+
+        if((length == 8) && !strncmp(frame, "shutdown", 8)){
+            respond(c, 0, NULL, 0);
+            stop = 1;
+        } else {
+            serve_request(c, frame, length, depth);
+        }
+
+        at += sizeof(uint32_t) + length;
+    }
+
+    memmove(c->in.data, c->in.data + at, c->in.used - at);
+    c->in.used -= at;
+
+    return stop;
+}
+
+/// @brief Serve render requests on a Unix domain socket at `path` until a client sends `shutdown`
+/// @param path
+/// @param depth used for requests that don't give one
+/// @return
+int serve(const char* path, int depth){
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        printf("[ERROR] socket path %s is too long\n", path);
+        return -1;
+    }
+
+    strcpy(addr.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(path); // left behind by a server that didn't shut down
+
+    if((listener < 0) || (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(listener, SERVER_MAX_CLIENTS) != 0)){
+        printf("[ERROR] could not listen on %s\n", path);
+
+        if(listener >= 0) close(listener);
+        return -1;
+    }
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev);
+
+    init_pool();
+    server_pixels = (unsigned char*)malloc(sizeof(Pixel) * IMAGE_SIZE * IMAGE_SIZE);
+    assert(server_pixels != NULL);
+
+    printf("Serving on %s\n", path);
+    fflush(stdout);
+
+    int running = 1;
+    struct epoll_event events[SERVER_EVENTS];
+
+    while(running){
+        int n = epoll_wait(ep, events, SERVER_EVENTS, -1);
+
+        if((n < 0) && (errno != EINTR)){
+            printf("[ERROR] epoll_wait failed\n");
+            break;
+        }
+
+        for(int i = 0; i < n; ++i){
+            Client* c = (Client*)events[i].data.ptr;
+
+            if(c == NULL){
+                accept_clients(ep, listener);
+                continue;
+            }
+
+            int gone = 0;
+
+            if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+                int res = read_client(c, depth);
+
+                gone = res < 0;
+                running &= res != 1;
+            }
+
+            if(!gone && (flush_client(c) != 0)){
+                gone = 1;
+            }
+
+            if(gone || (c->closing && (c->out.used == 0))){
+                close_client(ep, c);
+                continue;
+            }
+
+            // only wait for the socket to take more output while there is some
+            struct epoll_event update = {.events = EPOLLIN | ((c->out.used != 0) ? EPOLLOUT : 0), .data.ptr = c};
+            epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &update);
+        }
+
+        fflush(stdout);
+    }
+
+    for(int i = 0; i < SERVER_MAX_CLIENTS; ++i){
+        if(clients[i] != NULL){
+            flush_client(clients[i]);
+            close_client(ep, clients[i]);
+        }
+    }
+
+    close(ep);
+    close(listener);
+    unlink(path);
+
+    free(server_pixels);
+    free(request_text.data);
+    request_text = (Text){0};
+
+    printf("Stopped serving on %s\n\n", path);
+
+    return 0;
+}
+
+#endif
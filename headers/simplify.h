@@ -0,0 +1,293 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "ast.h"
+#include "range.h"
+
+/*
+    Simplification pass, run once after an AST is built. Constant subtrees are folded with the same float operations the
+    interpreter uses, so images don't change, and identities are only applied where they give the same result at every pixel,
+    including the zero divisor guard of div and mod, which is why some need the operand to be provably finite or non-zero.
+*/
+
+Ast source; // AST being simplified, simplified nodes are rebuilt into `ast`
+
+#ifdef DEBUG
+#define source_loc(index) source.debug[index].line, source.debug[index].file
+#else
+#define source_loc(index) ((void)(index), 0), NULL
+#endif
+
+typedef struct {
+    size_t index; // in `ast`
+    Interval range;
+} Simplified;
+
+/// @brief Check if the subtrees at `a` and `b` in `ast` compute the same function
+int same_subtree(size_t a, size_t b){
+    Node* na = ast.array + a;
+    Node* nb = ast.array + b;
+
+    if(a == b){
+        return 1;
+    } else if (na->op != nb->op){
+        return 0;
+    }
+
+    Node_kind nk = node_kind(na);
+
+    if(nk == NK_NUMBER){
+        return na->as.number == nb->as.number;
+    } else if (nk & NK_AFFINE){
+        return (na->as.affine.scale == nb->as.affine.scale) && (na->as.affine.offset == nb->as.affine.offset);
+    } else if (nk & NK_UNOP){
+        return same_subtree(na->as.unop, nb->as.unop);
+    } else if (nk & NK_BINOP){
+        return same_subtree(na->as.binop.lhs, nb->as.binop.lhs) && same_subtree(na->as.binop.rhs, nb->as.binop.rhs);
+    } else if (nk & (NK_TRIPLE | NK_TERNOP)){
+        return same_subtree(na->as.triple.first, nb->as.triple.first) && same_subtree(na->as.triple.second, nb->as.triple.second) &&
+            same_subtree(na->as.triple.third, nb->as.triple.third);
+    } else {
+        return 1; // x or y
+    }
+}
+
+Simplified simplified_number(float n, size_t index){
+    return (Simplified){node_number_loc(n, source_loc(index)), {n, n}};
+}
+
+/// @brief Fold an operator applied to constants, exactly as `eval_ast` would compute it
+/// @return
+float fold(Node_kind nk, float lhs, float rhs){
+
+    switch(nk){
+        case NK_SIN: return sin(lhs);
+        case NK_COS: return cos(lhs);
+        case NK_EXP: return exp(lhs);
+        case NK_ADD: return lhs + rhs;
+        case NK_MULT: return lhs * rhs;
+        case NK_GEQ: return lhs >= rhs;
+        case NK_MOD: return fmod(lhs, (rhs == 0.0) ? 1.0 : rhs);
+        case NK_DIV: return lhs / ((rhs == 0.0) ? 1.0 : rhs);
+
+        case NK_X:
+        case NK_Y:
+        case NK_NUMBER:
+        case NK_FMA:
+        case NK_AFFINE_X:
+        case NK_AFFINE_Y:
+        case NK_E:
+        case NK_IF_THEN_ELSE:
+        default:
+            printf("Cannot fold node of kind %d!\n", nk);
+            exit(-1);
+    }
+}
+
+/// @brief Apply identities to a binop whose operands are already simplified
+/// @param nk
+/// @param lhs
+/// @param rhs
+/// @param index of the binop in `source`
+/// @return
+Simplified simplify_binop(Node_kind nk, Simplified lhs, Simplified rhs, size_t index){
+    int lhs_const = lhs.range.lo == lhs.range.hi;
+    int rhs_const = rhs.range.lo == rhs.range.hi;
+
+    if(lhs_const && rhs_const){
+        return simplified_number(fold(nk, lhs.range.lo, rhs.range.lo), index);
+    }
+
+    switch(nk){
+        case NK_ADD:
+            if(is_constant_range(lhs.range, 0)) return rhs;
+            if(is_constant_range(rhs.range, 0)) return lhs;
+            break;
+
+        case NK_MULT:
+            if(is_constant_range(lhs.range, 1)) return rhs;
+            if(is_constant_range(rhs.range, 1)) return lhs;
+            if((is_constant_range(lhs.range, 0) && is_finite(rhs.range)) || (is_constant_range(rhs.range, 0) && is_finite(lhs.range))){
+                return simplified_number(0, index);
+            }
+            break;
+
+        case NK_DIV:
+            // dividing by 0 divides by 1
+            if(is_constant_range(rhs.range, 0) || is_constant_range(rhs.range, 1)) return lhs;
+            if(is_finite(lhs.range) && excludes_zero(lhs.range) && same_subtree(lhs.index, rhs.index)){
+                return simplified_number(1, index);
+            }
+            break;
+
+        case NK_MOD:
+            if(is_finite(lhs.range) && same_subtree(lhs.index, rhs.index)){
+                return simplified_number(0, index);
+            }
+            break;
+
+        case NK_GEQ:
+            if(is_finite(lhs.range) && same_subtree(lhs.index, rhs.index)){
+                return simplified_number(1, index);
+            }
+            if(lhs.range.lo >= rhs.range.hi){
+                return simplified_number(1, index);
+            }
+            if(lhs.range.hi < rhs.range.lo){
+                return simplified_number(0, index);
+            }
+            break;
+
+        case NK_X:
+        case NK_Y:
+        case NK_NUMBER:
+        case NK_SIN:
+        case NK_COS:
+        case NK_EXP:
+        case NK_FMA:
+        case NK_AFFINE_X:
+        case NK_AFFINE_Y:
+        case NK_E:
+        case NK_IF_THEN_ELSE:
+        default:
+            break;
+    }
+
+    return (Simplified){node_binop_loc(nk, lhs.index, rhs.index, source_loc(index)), range_of_op(nk, lhs.range, rhs.range)};
+}
+
+/// @brief Rebuild the subtree at `index` in `source` into `ast`, simplified
+/// @param index
+/// @return
+Simplified simplify_node(size_t index){
+    Node* n = source.array + index;
+    Node_kind nk = node_kind(n);
+
+    if(nk == NK_NUMBER){
+        return simplified_number(n->as.number, index);
+
+    } else if ((nk == NK_X) || (nk == NK_Y)){
+        size_t node = (nk == NK_X) ? node_x_loc(source_loc(index)) : node_y_loc(source_loc(index));
+
+        return (Simplified){node, range_of_op(nk, UNBOUNDED, UNBOUNDED)};
+
+    } else if (nk & NK_AFFINE){
+        size_t node = node_affine_loc(nk, n->as.affine.scale, n->as.affine.offset, source_loc(index));
+
+        return (Simplified){node, node_range(node)};
+
+    } else if (nk == NK_FMA){
+        // fused nodes come from the peephole pass, which runs after simplification, so they are only copied
+        Simplified a = simplify_node(n->as.triple.first);
+        Simplified b = simplify_node(n->as.triple.second);
+        Simplified c = simplify_node(n->as.triple.third);
+        size_t node = node_fma_loc(a.index, b.index, c.index, source_loc(index));
+
+        return (Simplified){node, range_of_op(NK_ADD, range_mult(a.range, b.range), c.range)};
+
+    } else if (nk & NK_UNOP){
+        Simplified arg = simplify_node(n->as.unop);
+
+        if(arg.range.lo == arg.range.hi){
+            return simplified_number(fold(nk, arg.range.lo, 0), index);
+        }
+
+        return (Simplified){node_unop_loc(nk, arg.index, source_loc(index)), range_of_op(nk, arg.range, UNBOUNDED)};
+
+    } else if (nk & NK_BINOP){
+        Simplified lhs = simplify_node(n->as.binop.lhs);
+        Simplified rhs = simplify_node(n->as.binop.rhs);
+
+        return simplify_binop(nk, lhs, rhs, index);
+
+    } else if (nk == NK_IF_THEN_ELSE){
+        Simplified cond = simplify_node(n->as.triple.first);
+
+        if(cond.range.lo == cond.range.hi){
+            return simplify_node((cond.range.lo != 0) ? n->as.triple.second : n->as.triple.third);
+        }
+
+        Simplified then = simplify_node(n->as.triple.second);
+        Simplified otherwise = simplify_node(n->as.triple.third);
+
+        return (Simplified){node_triple_loc(nk, cond.index, then.index, otherwise.index, source_loc(index)), UNBOUNDED};
+
+    } else {
+        Simplified first = simplify_node(n->as.triple.first);
+        Simplified second = simplify_node(n->as.triple.second);
+        Simplified third = simplify_node(n->as.triple.third);
+
+        return (Simplified){node_triple_loc(nk, first.index, second.index, third.index, source_loc(index)), UNBOUNDED};
+    }
+}
+
+/// @brief Number of nodes reachable from `index`
+size_t count_nodes(size_t index){
+    Node* n = ast.array + index;
+    Node_kind nk = node_kind(n);
+
+    if(nk & NK_UNOP){
+        return 1 + count_nodes(n->as.unop);
+    } else if (nk & NK_BINOP){
+        return 1 + count_nodes(n->as.binop.lhs) + count_nodes(n->as.binop.rhs);
+    } else if (nk & (NK_TRIPLE | NK_TERNOP)){
+        return 1 + count_nodes(n->as.triple.first) + count_nodes(n->as.triple.second) + count_nodes(n->as.triple.third);
+    } else {
+        return 1;
+    }
+}
+
+size_t simplify_root(size_t index){
+    return simplify_node(index).index;
+}
+
+/// @brief Copy the subtree at `index` in `source` into `ast`, in post-order
+/// @param index
+/// @return
+size_t copy_node(size_t index){
+    Node n = source.array[index];
+    Node_kind nk = node_kind(&n);
+
+    if(nk & NK_UNOP){
+        n.as.unop = copy_node(n.as.unop);
+
+    } else if (nk & NK_BINOP){
+        n.as.binop.lhs = copy_node(n.as.binop.lhs);
+        n.as.binop.rhs = copy_node(n.as.binop.rhs);
+
+    } else if (nk & (NK_TRIPLE | NK_TERNOP)){
+        n.as.triple.first = copy_node(n.as.triple.first);
+        n.as.triple.second = copy_node(n.as.triple.second);
+        n.as.triple.third = copy_node(n.as.triple.third);
+    }
+
+    return add_node_to_ast(n, source_loc(index));
+}
+
+/// @brief Replace `ast` with what `rebuild` builds from the AST at its root
+/// @param rebuild builds the subtree at the index it is given in `source` into `ast`
+void rebuild_ast(size_t (*rebuild)(size_t index)){
+    source = ast;
+    ast = (Ast){0};
+    init_ast(source.used);
+
+    ast.ast_root = rebuild(source.ast_root);
+
+    Ast rebuilt = ast;
+    ast = source;
+    free_ast();
+    ast = rebuilt;
+}
+
+/// @brief Simplify the AST rooted at `ast.ast_root`. The simplified AST replaces it, holding only reachable nodes, with its root last
+/// @return number of nodes removed
+size_t simplify_ast(){
+    size_t before = count_nodes(ast.ast_root);
+
+    rebuild_ast(simplify_root);
+    rebuild_ast(copy_node); // drop nodes that were folded away
+
+    return before - ast.used;
+}
+
+#endif
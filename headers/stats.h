@@ -0,0 +1,98 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <math.h>
+#include "utils.h"
+
+/*
+    Image statistics, accumulated while rendering so that nothing has to read the png back. Pixel levels are counted into
+    histograms kept per render unit, everything else is derived from the merged histograms once rendering is done.
+*/
+
+typedef struct {
+    U64 histogram[3][256]; // pixels at each 8 bit level, per channel
+    U64 pixels;
+
+    // filled by `finish_stats`
+    int min[3];
+    int max[3];
+    double mean[3];
+    double variance[3];
+} Render_stats;
+
+const char* channel_names[3] = {"r", "g", "b"};
+
+/// @brief Count one pixel, with the channel levels it is written to the image with
+void accumulate_stats(Render_stats* s, unsigned char r, unsigned char g, unsigned char b){
+    s->histogram[0][r]++;
+    s->histogram[1][g]++;
+    s->histogram[2][b]++;
+    s->pixels++;
+}
+
+/// @brief Add the counts of `other` to `s`
+void merge_stats(Render_stats* s, const Render_stats* other){
+    for(int c = 0; c < 3; ++c){
+        for(int l = 0; l < 256; ++l){
+            s->histogram[c][l] += other->histogram[c][l];
+        }
+    }
+
+    s->pixels += other->pixels;
+}
+
+/// @brief Count every pixel `times` times, for samples that fill a block of the image
+void scale_stats(Render_stats* s, int times){
+    for(int c = 0; c < 3; ++c){
+        for(int l = 0; l < 256; ++l){
+            s->histogram[c][l] *= times;
+        }
+    }
+
+    s->pixels *= times;
+}
+
+/// @brief Derive min, max, mean and variance of each channel from the histograms
+void finish_stats(Render_stats* s){
+    for(int c = 0; c < 3; ++c){
+        double sum = 0, sum_sq = 0;
+
+        s->min[c] = 255;
+        s->max[c] = 0;
+
+        for(int l = 0; l < 256; ++l){
+            if(s->histogram[c][l] == 0) continue;
+
+            s->min[c] = (l < s->min[c]) ? l : s->min[c];
+            s->max[c] = (l > s->max[c]) ? l : s->max[c];
+
+            sum += (double)l * s->histogram[c][l];
+            sum_sq += (double)l * l * s->histogram[c][l];
+        }
+
+        s->mean[c] = (s->pixels == 0) ? 0 : sum / s->pixels;
+        s->variance[c] = (s->pixels == 0) ? 0 : sum_sq / s->pixels - s->mean[c] * s->mean[c];
+    }
+}
+
+/// @brief Print each channel's range, mean, standard deviation and a coarse histogram of 8 buckets, as percentages of pixels
+void print_render_stats(const Render_stats* s){
+    for(int c = 0; c < 3; ++c){
+        printf("%s: min %3d max %3d mean %6.1f stddev %5.1f |", channel_names[c], s->min[c], s->max[c], s->mean[c], sqrt(s->variance[c]));
+
+        for(int bucket = 0; bucket < 8; ++bucket){
+            U64 count = 0;
+
+            for(int l = bucket * 32; l < (bucket + 1) * 32; ++l){
+                count += s->histogram[c][l];
+            }
+
+            printf(" %5.1f%%", (s->pixels == 0) ? 0.0 : 100.0 * count / s->pixels);
+        }
+
+        printf("\n");
+    }
+}
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef SYMMETRY_H
+#define SYMMETRY_H
+
+#include "ast.h"
+
+/*
+    Parity analysis. A channel is even in x if f(-x, y) = f(x, y) and odd if f(-x, y) = -f(x, y), and the same for y. Pixel
+    coordinates are exact in float and mirror exactly (pixel i and size - i), and every operator the proof relies on is
+    sign symmetric in float, so the mirrored half of an image is bit for bit what evaluating it would give.
+*/
+
+typedef enum {
+    PAR_NONE,
+    PAR_EVEN,
+    PAR_ODD
+} Parity;
+
+const char* parity_names[] = {"none", "even", "odd"};
+
+Parity parity_mult(Parity a, Parity b){
+    if((a == PAR_NONE) || (b == PAR_NONE)){
+        return PAR_NONE;
+    }
+
+    return (a == b) ? PAR_EVEN : PAR_ODD;
+}
+
+Parity parity_add(Parity a, Parity b){
+    return (a == b) ? a : PAR_NONE;
+}
+
+/// @brief Parity of `nk` applied to operands of parity `a` and `b`. Unary operators only use `a`
+/// @param nk
+/// @param a
+/// @param b
+/// @return
+Parity parity_of_op(Node_kind nk, Parity a, Parity b){
+
+    switch(nk){
+        case NK_SIN: return a;
+        case NK_COS: return (a == PAR_NONE) ? PAR_NONE : PAR_EVEN;
+        case NK_EXP: return (a == PAR_EVEN) ? PAR_EVEN : PAR_NONE;
+
+        case NK_ADD: return parity_add(a, b);
+        case NK_MULT: return parity_mult(a, b);
+
+        // a zero divisor is replaced by 1, which is only symmetric if the divisor is even
+        case NK_DIV: return (b == PAR_EVEN) ? a : PAR_NONE;
+
+        // fmod keeps the sign of the dividend and ignores the sign of the divisor
+        case NK_MOD: return (b == PAR_NONE) ? PAR_NONE : a;
+
+        case NK_GEQ: return ((a == PAR_EVEN) && (b == PAR_EVEN)) ? PAR_EVEN : PAR_NONE;
+
+        case NK_X:
+        case NK_Y:
+        case NK_NUMBER:
+        case NK_FMA:
+        case NK_AFFINE_X:
+        case NK_AFFINE_Y:
+        case NK_E:
+        case NK_IF_THEN_ELSE:
+        default:
+            return PAR_NONE;
+    }
+}
+
+/// @brief Parity in `var` of the channel subtree at `index`
+/// @param index
+/// @param var `NK_X` or `NK_Y`
+/// @return
+Parity node_parity(size_t index, Node_kind var){
+    Node* n = ast.array + index;
+    Node_kind nk = node_kind(n);
+
+    if(nk == NK_NUMBER){
+        return PAR_EVEN;
+
+    } else if ((nk == NK_X) || (nk == NK_Y)){
+        return (nk == var) ? PAR_ODD : PAR_EVEN;
+
+    } else if (nk & NK_AFFINE){
+        if((nk == NK_AFFINE_X) != (var == NK_X)){
+            return PAR_EVEN;
+        }
+
+        return (n->as.affine.offset == 0) ? PAR_ODD : (n->as.affine.scale == 0) ? PAR_EVEN : PAR_NONE;
+
+    } else if (nk == NK_FMA){
+        Parity product = parity_mult(node_parity(n->as.triple.first, var), node_parity(n->as.triple.second, var));
+
+        return parity_add(product, node_parity(n->as.triple.third, var));
+
+    } else if (nk & NK_UNOP){
+        return parity_of_op(nk, node_parity(n->as.unop, var), PAR_NONE);
+
+    } else if (nk & NK_BINOP){
+        return parity_of_op(nk, node_parity(n->as.binop.lhs, var), node_parity(n->as.binop.rhs, var));
+    }
+
+    return PAR_NONE;
+}
+
+/// @brief Parity in `var` of each channel of the AST rooted at `index`, an E or an if-then-else of Es
+/// @param index
+/// @param var `NK_X` or `NK_Y`
+/// @param channels
+void root_parity(size_t index, Node_kind var, Parity channels[3]){
+    Node* n = ast.array + index;
+
+    if(node_kind(n) == NK_IF_THEN_ELSE){
+        Parity then[3], otherwise[3];
+
+        root_parity(n->as.triple.second, var, then);
+        root_parity(n->as.triple.third, var, otherwise);
+
+        // the same branch must be taken at mirrored pixels
+        int cond_even = node_parity(n->as.triple.first, var) == PAR_EVEN;
+
+        for(int c = 0; c < 3; ++c){
+            channels[c] = cond_even ? parity_add(then[c], otherwise[c]) : PAR_NONE;
+        }
+
+    } else {
+        channels[0] = node_parity(n->as.triple.first, var);
+        channels[1] = node_parity(n->as.triple.second, var);
+        channels[2] = node_parity(n->as.triple.third, var);
+    }
+}
+
+/// @brief Fill the right half of `row` with the mirror image of its left half, negated if `p` is odd. Pixel `i` mirrors pixel `size - i`
+/// @param row only columns up to `size / 2` need to be filled in
+/// @param size
+/// @param p
+void mirror_columns(float* row, int size, Parity p){
+    for(int x = size / 2 + 1; x < size; ++x){
+        row[x] = (p == PAR_ODD) ? -row[size - x] : row[size - x];
+    }
+}
+
+/// @brief Fill `row` with the row it mirrors along y, negated if `p` is odd
+/// @param row
+/// @param mirrored row `size - y` for row `y`
+/// @param size
+/// @param p
+void mirror_row(float* row, const float* mirrored, int size, Parity p){
+    for(int x = 0; x < size; ++x){
+        row[x] = (p == PAR_ODD) ? -mirrored[x] : mirrored[x];
+    }
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdio.h>
+#include <stdarg.h>
 #include <math.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -14,6 +16,8 @@
 typedef enum{
     RM_RENDER,
     RM_TEST,
+    RM_PREVIEW,
+    RM_DISTRIBUTE,
     RM_PRINT
 } Run_mode;
 
@@ -22,6 +26,13 @@ typedef struct {
     int none;
 } Option;
 
+/// @brief Growable byte buffer, for output that is built up before it is written out in one go
+typedef struct {
+    char* data;
+    size_t used;
+    size_t capacity;
+} Text;
+
 Option wrap_value(size_t value, int none){
     Option wrapper = {.none = none};
 
@@ -32,31 +43,6 @@ Option wrap_value(size_t value, int none){
     return wrapper;
 }
 
-#define NUMBER "[[:digit:]]+" 
-#define FLOAT "(-)?" NUMBER "(." NUMBER ")?" "|" "." NUMBER
-#define OPEN_BRACKET "\\("
-#define CLOSE_BRACKET "\\)"
-
-const char* AST_PATTERNS[] = {
-    "add",
-    "div",
-    "sin",
-    "cos",
-    "exp",
-    "mod",
-    "mult",
-    "geq",
-    "x",
-    "y",
-    "E",
-    ",",
-    "if",
-    "else",
-    OPEN_BRACKET,
-    CLOSE_BRACKET,
-    FLOAT,
-};
-
 float randrange(float min, float max){
     assert(max > min);
     
@@ -68,6 +54,54 @@ float clamp(float x, float min, float max){
     if(x > max){return max;} else {return x;}
 }  
 
+void text_reserve(Text* t, size_t bytes){
+    if(t->used + bytes <= t->capacity){
+        return;
+    }
+
+    t->capacity = (t->used + bytes) * 2;
+    t->data = (char*)realloc(t->data, t->capacity);
+    assert(t->data != NULL);
+}
+
+void text_printf(Text* t, const char* format, ...){
+    va_list args;
+
+    text_reserve(t, 64);
+
+    va_start(args, format);
+    int n = vsnprintf(t->data + t->used, t->capacity - t->used, format, args);
+    va_end(args);
+
+    if((size_t)n >= t->capacity - t->used){
+        text_reserve(t, n + 1);
+
+        va_start(args, format);
+        vsnprintf(t->data + t->used, t->capacity - t->used, format, args);
+        va_end(args);
+    }
+
+    t->used += n;
+}
+
+void text_char(Text* t, char c){
+    text_reserve(t, 1);
+    t->data[t->used++] = c;
+}
+
+void text_append(Text* t, const void* data, size_t length){
+    text_reserve(t, length);
+    memcpy(t->data + t->used, data, length);
+    t->used += length;
+}
+
+double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
 static int get_input(char* buffer){
     printf("> ");
     memset(buffer, 0, INPUT_SIZE);
@@ -6,6 +6,13 @@ int main(){
 
     run();
 
+    free_coordinator();
+    free_scheduler();
+    free_cache();
+    free_planes();
+    free_pool();
+    free_buffers();
+    free_preview();
     free_ast();
     free_grammar();
     